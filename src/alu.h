@@ -0,0 +1,72 @@
+#ifndef ALU_H
+#define ALU_H
+#include <stdint.h>
+// ADC and SBC on the accumulator and status byte, shared by cpu.c and tools/alucheck, which runs them
+// on the host against a plain model of the NMOS 6510 for every operand. Apart from picking the mode
+// from D, results and flags come from table lookups, shifts and masks, without branches.
+
+// the flags ADC and SBC set: N, V, Z and C
+#define ALU_FLAGS 0xC3
+
+// N and Z flags for each result byte
+static const uint8_t NZ[256] = {
+    0x02,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80, 0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80, 0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80, 0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+    0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80, 0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+};
+
+// a sum of two decimal digits and a carry, 0 to 31, adjusted: the digit in the low nibble and the
+// carry into the next digit in bit 4
+static const uint8_t BCD_ADD[32] = {
+    0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x10,0x11,0x12,0x13,0x14,0x15,
+    0x16,0x17,0x18,0x19,0x1A,0x1B,0x1C,0x1D,0x1E,0x1F,0x10,0x11,0x12,0x13,0x14,0x15,
+};
+
+// a difference of two decimal digits minus a borrow, -16 to 15 and indexed from 16, adjusted the way
+// the NMOS 6510 does it
+static const int8_t BCD_SUB[32] = {
+    -6,-5,-4,-3,-2,-1,-16,-15,-14,-13,-12,-11,-10,-9,-8,-7,
+    0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,
+};
+
+// binary add with carry, also used for SBC with the operand inverted
+static inline uint8_t adc_binary(uint8_t a, uint8_t m, uint8_t *p) {
+    uint16_t sum = a + m + (*p & 0x01);
+    uint8_t result = sum;
+    // overflow when both operands have the same sign and the result doesn't
+    *p = (*p & ~ALU_FLAGS) | NZ[result] | (sum >> 8) | (((a ^ result) & (m ^ result) & 0x80) >> 1);
+    return result;
+}
+
+// NMOS decimal mode: Z comes from the binary sum, N and V from the sum before the high digit is adjusted
+static inline uint8_t adc_decimal(uint8_t a, uint8_t m, uint8_t *p) {
+    uint8_t binary = a + m + (*p & 0x01);
+    uint8_t lo = BCD_ADD[(a & 0x0F) + (m & 0x0F) + (*p & 0x01)];
+    uint16_t hi = (a & 0xF0) + (m & 0xF0) + (lo & 0x10);
+    uint8_t high = BCD_ADD[hi >> 4];
+    *p = (*p & ~ALU_FLAGS) | (NZ[binary] & 0x02) | (hi & 0x80) | (((a ^ hi) & (m ^ hi) & 0x80) >> 1) | (high >> 4);
+    return (high << 4) | (lo & 0x0F);
+}
+
+// NMOS decimal mode: the flags are the same as in binary mode, only the result is adjusted
+static inline uint8_t sbc_decimal(uint8_t a, uint8_t m, uint8_t *p) {
+    int16_t lo = BCD_SUB[(a & 0x0F) - (m & 0x0F) - ((*p & 0x01) ^ 0x01) + 16];
+    adc_binary(a, ~m, p);
+    int16_t hi = (a & 0xF0) - (m & 0xF0) + lo;
+    // a borrow out of the high digit leaves hi negative, so hi >> 8 is all ones
+    return hi - (0x60 & (hi >> 8));
+}
+
+static inline uint8_t alu_adc(uint8_t a, uint8_t m, uint8_t *p) {
+    return (*p & 0x08) ? adc_decimal(a, m, p) : adc_binary(a, m, p);
+}
+
+static inline uint8_t alu_sbc(uint8_t a, uint8_t m, uint8_t *p) {
+    return (*p & 0x08) ? sbc_decimal(a, m, p) : adc_binary(a, ~m, p);
+}
+#endif
@@ -0,0 +1,114 @@
+#include <ti/vars.h>
+#include <fileioc.h>
+#include <debug.h>
+#include <stdlib.h>
+#include "budget.h"
+
+// Keeps track of who got how much memory at startup. The C64's RAM is taken first, from AppVars in
+// user RAM or from the heap when those can't be made, and the optional parts (the RAM expansion unit
+// in user RAM and the ROM shadows on the heap) size themselves to what budget_free and budget_heap
+// say is left.
+//
+// Making, resizing or deleting an AppVar can move the data of every other AppVar in RAM, which leaves
+// a data pointer taken before it pointing at whatever moved in. So everything the emulator keeps a
+// pointer into, or writes to while it runs, is made at its full size at startup with budget_appvar,
+// and only once the last one is made does budget_pointers look up where they all ended up.
+
+#define MAX_ENTRIES 12
+#define MAX_APPVARS 12
+
+typedef struct budget_entry {
+    const char *subsystem;
+    size_t bytes;
+    uint8_t heap;
+} budget_entry_t;
+
+typedef struct budget_appvar {
+    const char *name;
+    uint8_t **data;
+} budget_appvar_t;
+
+static budget_entry_t entries[MAX_ENTRIES];
+static uint8_t count;
+static budget_appvar_t appvars[MAX_APPVARS];
+static uint8_t appvar_count;
+
+// user RAM the optional parts can have
+size_t budget_free(void) {
+    void *unused;
+    size_t left = os_MemChk(&unused);
+    return left > BUDGET_RESERVE ? left - BUDGET_RESERVE : 0;
+}
+
+void budget_take(const char *subsystem, size_t bytes, uint8_t heap) {
+    if (count < MAX_ENTRIES) {
+        entries[count].subsystem = subsystem;
+        entries[count].bytes = bytes;
+        entries[count].heap = heap;
+        count++;
+    }
+}
+
+// Make the AppVar size bytes long, or with size 0 keep the one that's there as it is. *data is filled
+// in by budget_pointers. Returns 0, with nothing made, if there wasn't room or there's no such AppVar
+uint8_t budget_appvar(const char *name, size_t size, uint8_t **data) {
+    uint8_t fp = ti_Open(name, size ? "w+" : "r");
+    if (!fp) {
+        return 0;
+    }
+    if (size && (ti_Resize(size, fp) != (int) size)) {
+        ti_Close(fp);
+        ti_Delete(name);
+        return 0;
+    }
+    ti_Close(fp);
+    if (appvar_count < MAX_APPVARS) {
+        appvars[appvar_count].name = name;
+        appvars[appvar_count].data = data;
+        appvar_count++;
+    }
+    return 1;
+}
+
+// where each AppVar from budget_appvar is now, NULL for ones deleted again since
+void budget_pointers(void) {
+    for (uint8_t i = 0; i < appvar_count; i++) {
+        uint8_t fp = ti_Open(appvars[i].name, "r");
+        *appvars[i].data = fp ? ti_GetDataPtr(fp) : NULL;
+        if (fp) {
+            ti_Close(fp);
+        }
+    }
+}
+
+// Cut an output made with budget_appvar down to the size bytes written to it. This moves the other
+// AppVars too, so it's only for when the emulator has stopped using their data pointers
+void budget_trim(const char *name, size_t size) {
+    uint8_t fp = ti_Open(name, "r+");
+    if (fp) {
+        ti_Resize(size, fp);
+        ti_Close(fp);
+    }
+}
+
+// the largest block the heap can still give, to within 256 bytes
+size_t budget_heap(void) {
+    size_t size = 0;
+    for (size_t step = 0x8000; step >= 0x100; step >>= 1) {
+        void *block = malloc(size + step);
+        if (block) {
+            free(block);
+            size += step;
+        }
+    }
+    return size;
+}
+
+void budget_report(void) {
+    void *unused;
+    for (uint8_t i = 0; i < count; i++) {
+        dbg_printf("memory: %s %uK from the %s\n", entries[i].subsystem, (unsigned) (entries[i].bytes >> 10),
+                    entries[i].heap ? "heap" : "user RAM");
+    }
+    dbg_printf("memory: %u bytes of user RAM and %u of heap left\n", (unsigned) os_MemChk(&unused), (unsigned) budget_heap());
+}
@@ -0,0 +1,14 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+#include <stddef.h>
+#include <stdint.h>
+// user RAM left for the OS
+#define BUDGET_RESERVE 0x2000
+size_t budget_free(void);
+size_t budget_heap(void);
+uint8_t budget_appvar(const char *name, size_t size, uint8_t **data);
+void budget_pointers(void);
+void budget_trim(const char *name, size_t size);
+void budget_take(const char *subsystem, size_t bytes, uint8_t heap);
+void budget_report(void);
+#endif
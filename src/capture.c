@@ -0,0 +1,278 @@
+#include <fileioc.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "counters.h"
+#include "budget.h"
+
+#ifdef CAPTURE
+
+// Screen capture for runs without anyone watching, built with CAPTURE=YES. At the end of every frame
+// where screen or colour RAM was written, the screen is hashed, and when the hash changed it's
+// appended to the C64SCR AppVar as UTF-8 text. If the C64WAIT AppVar holds a line of text, the
+// emulator quits as soon as that text is on the screen. C64SCR and C64IMG are made at their full size
+// at startup and written in place, since making or growing an AppVar while the emulator runs would
+// move the C64's RAM, and C64SCR is cut down to what was written when it quits.
+
+// most of C64SCR's text, a screen takes about 1K
+#define TEXT_SIZE 0x8000
+
+// box drawing and block characters for screen codes $40 to $7F of the uppercase set
+static const uint24_t graphics[64] = {
+    0x2500, 0x2660, 0x2502, 0x2500, 0x1FB77, 0x1FB76, 0x1FB7A, 0x1FB71,
+    0x1FB74, 0x256E, 0x2570, 0x256F, 0x1FB7C, 0x2572, 0x2571, 0x1FB7D,
+    0x1FB7E, 0x25CF, 0x1FB7B, 0x2665, 0x1FB70, 0x256D, 0x2573, 0x25CB,
+    0x2663, 0x1FB75, 0x2666, 0x253C, 0x1FB8C, 0x2502, 0x03C0, 0x25E5,
+    0x00A0, 0x258C, 0x2584, 0x2594, 0x2581, 0x258F, 0x2592, 0x2595,
+    0x1FB8F, 0x25E4, 0x1FB87, 0x251C, 0x2597, 0x2514, 0x2510, 0x2582,
+    0x250C, 0x2534, 0x252C, 0x2524, 0x258E, 0x258D, 0x1FB88, 0x1FB82,
+    0x1FB83, 0x2583, 0x1FB7F, 0x2596, 0x259D, 0x2518, 0x2598, 0x259A,
+};
+
+#if CAPTURE_IMAGE
+// brightness of each C64 colour, for a greyscale picture small enough for an AppVar
+static const uint8_t grey[16] = {0, 255, 68, 150, 84, 117, 53, 185, 84, 53, 117, 68, 108, 184, 108, 149};
+static const char image_header[] = "P5\n320 200\n255\n";
+#define IMAGE_SIZE (sizeof(image_header) - 1 + 320 * 200)
+static uint8_t *image;
+#endif
+
+// C64SCR, NULL when it's full or there wasn't room for it
+static uint8_t *text;
+static uint16_t text_size;
+static uint16_t text_length;
+static char wait_for[41];
+static uint32_t last_writes;
+static uint32_t last_mode;
+static uint32_t last_hash;
+static uint24_t captures;
+
+// makes C64SCR and C64IMG, before budget_pointers
+void capture_alloc(void) {
+    size_t size = budget_free() < TEXT_SIZE ? budget_free() : TEXT_SIZE;
+    if (size && budget_appvar("C64SCR", size, &text)) {
+        text_size = size;
+        budget_take("C64SCR", size, 0);
+    } else {
+        dbg_printf("no room for C64SCR, not capturing\n");
+    }
+#if CAPTURE_IMAGE
+    if ((budget_free() >= IMAGE_SIZE) && budget_appvar("C64IMG", IMAGE_SIZE, &image)) {
+        budget_take("C64IMG", IMAGE_SIZE, 0);
+    } else {
+        dbg_printf("no room for C64IMG\n");
+    }
+#endif
+}
+
+void capture_init(void) {
+    // make the first frame count as a change
+    last_writes = ~counters.screen_writes;
+    uint8_t wait = ti_Open("C64WAIT", "r");
+    if (wait) {
+        uint16_t size = ti_GetSize(wait);
+        if (size > sizeof(wait_for) - 1) {
+            size = sizeof(wait_for) - 1;
+        }
+        memcpy(wait_for, ti_GetDataPtr(wait), size);
+        wait_for[strcspn(wait_for, "\r\n")] = 0;
+        ti_Close(wait);
+        dbg_printf("waiting for \"%s\"\n", wait_for);
+    }
+}
+
+static uint32_t screen_hash(mem_t *mem) {
+    // FNV-1a, ignoring the reverse bit so the blinking cursor doesn't count as a change
+    uint32_t hash = 2166136261UL;
+    for (uint16_t i = 0; i < 1000; i++) {
+        hash = (hash ^ (mem->memorya[0x400 + i] & 0x7F)) * 16777619UL;
+    }
+    for (uint16_t i = 0; i < 500; i++) {
+        hash = (hash ^ mem->color_ram[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+static char *put_utf8(char *out, uint24_t c) {
+    if (c < 0x80) {
+        *out++ = c;
+    } else if (c < 0x800) {
+        *out++ = 0xC0 | (c >> 6);
+        *out++ = 0x80 | (c & 0x3F);
+    } else if (c < 0x10000) {
+        *out++ = 0xE0 | (c >> 12);
+        *out++ = 0x80 | ((c >> 6) & 0x3F);
+        *out++ = 0x80 | (c & 0x3F);
+    } else {
+        *out++ = 0xF0 | (c >> 18);
+        *out++ = 0x80 | ((c >> 12) & 0x3F);
+        *out++ = 0x80 | ((c >> 6) & 0x3F);
+        *out++ = 0x80 | (c & 0x3F);
+    }
+    return out;
+}
+
+// reverse video has no Unicode equivalent, so it's shown like the normal character
+static uint24_t unicode(uint8_t code, uint8_t lowercase) {
+    code &= 0x7F;
+    if (code == 0x00) {
+        return '@';
+    }
+    if (code <= 0x1A) {
+        return code + (lowercase ? 'a' - 1 : 'A' - 1);
+    }
+    if (lowercase && (code >= 0x41) && (code <= 0x5A)) {
+        return code;
+    }
+    switch (code) {
+        case 0x1B: return '[';
+        case 0x1C: return 0x00A3;
+        case 0x1D: return ']';
+        case 0x1E: return 0x2191;
+        case 0x1F: return 0x2190;
+    }
+    if (code < 0x40) {
+        return code;
+    }
+    return graphics[code - 0x40];
+}
+
+// adds to C64SCR, 0 if it doesn't fit
+static uint8_t append(const char *data, uint16_t length) {
+    if (length > text_size - text_length) {
+        return 0;
+    }
+    memcpy(text + text_length, data, length);
+    text_length += length;
+    return 1;
+}
+
+static void write_text(cpu_t *cpu, uint32_t hash) {
+    mem_t *mem = cpu->memory;
+    uint8_t lowercase = mem->vic[0x18] & 0x02;
+    char line[40 * 4 + 2];
+    uint8_t length = sprintf(line, "frame %lu cycles %lu hash %08lX\n", (unsigned long) counters.frames,
+                                (unsigned long) cpu->cycles, (unsigned long) hash);
+    uint8_t ok = append(line, length);
+    for (uint8_t row = 0; ok && (row < 25); row++) {
+        char *out = line;
+        char *end = line;
+        for (uint8_t col = 0; col < 40; col++) {
+            uint8_t code = mem->memorya[0x400 + row * 40 + col];
+            out = put_utf8(out, unicode(code, lowercase));
+            if ((code & 0x7F) != ' ') {
+                end = out;
+            }
+        }
+        *end++ = '\n';
+        ok = append(line, end - line);
+    }
+    if (!ok) {
+        // keep what fits and stop capturing
+        dbg_printf("C64SCR is full after %u screens\n", captures);
+        text = NULL;
+    }
+}
+
+#if CAPTURE_IMAGE
+// hires text and bitmap modes, multicolour is drawn as hires
+static void write_image(mem_t *mem) {
+    uint8_t *regs = mem->vic;
+    memcpy(image, image_header, sizeof(image_header) - 1);
+    uint8_t *row = image + sizeof(image_header) - 1;
+    for (uint8_t y = 0; y < 200; y++, row += 320) {
+        for (uint8_t col = 0; col < 40; col++) {
+            uint16_t pos = (y >> 3) * 40 + col;
+            uint8_t val = mem->memorya[0x400 + pos];
+            uint8_t bits, fg, bg;
+            if (regs[0x11] & 0x20) {
+                bits = vic_peek(mem, ((regs[0x18] & 0x08) << 10) + pos * 8 + (y & 7));
+                fg = val >> 4;
+                bg = val & 0x0F;
+            } else {
+                fg = color_peek(mem, pos);
+                bg = regs[0x21] & 0x0F;
+                if (regs[0x11] & 0x40) {
+                    bg = regs[0x21 + (val >> 6)] & 0x0F;
+                    val &= 0x3F;
+                }
+                bits = vic_peek(mem, ((regs[0x18] & 0x0E) << 10) + val * 8 + (y & 7));
+            }
+            for (uint8_t x = 0; x < 8; x++, bits <<= 1) {
+                row[col * 8 + x] = grey[(bits & 0x80) ? fg : bg];
+            }
+        }
+    }
+}
+#endif
+
+// the text, with letters in either case, anywhere on the screen including across line ends
+uint8_t capture_contains(mem_t *mem, const char *text) {
+    uint8_t length = strlen(text);
+    if (!length) {
+        return 0;
+    }
+    for (uint16_t start = 0; start <= 1000 - length; start++) {
+        uint8_t i;
+        for (i = 0; i < length; i++) {
+            uint8_t code = mem->memorya[0x400 + start + i] & 0x7F;
+            char c = text[i];
+            if ((c >= 'a') && (c <= 'z')) {
+                c -= 'a' - 'A';
+            }
+            // screen codes for letters are 1 to 26, everything from space up is ASCII
+            uint8_t want = ((c >= '@') && (c <= '_')) ? c - '@' : c;
+            if (((code >= 0x41) && (code <= 0x5A) ? code - 0x40 : code) != want) {
+                break;
+            }
+        }
+        if (i == length) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// called at the end of every frame, returns 1 once the text in C64WAIT is on the screen
+uint8_t capture_frame(cpu_t *cpu) {
+    mem_t *mem = cpu->memory;
+    uint8_t *regs = mem->vic;
+    // the character set and text colours live in VIC registers rather than screen RAM
+    uint32_t mode = ((uint32_t) regs[0x11] << 24) | ((uint32_t) regs[0x16] << 16) | (regs[0x18] << 8) | regs[0x21];
+    if ((counters.screen_writes == last_writes) && (mode == last_mode)) {
+        return 0;
+    }
+    last_writes = counters.screen_writes;
+    last_mode = mode;
+    uint32_t hash = screen_hash(mem) ^ mode;
+    if (hash == last_hash) {
+        return 0;
+    }
+    last_hash = hash;
+    captures++;
+    if (text) {
+        write_text(cpu, hash);
+    }
+#if CAPTURE_IMAGE
+    if (image) {
+        write_image(mem);
+    }
+#endif
+    if (wait_for[0] && capture_contains(mem, wait_for)) {
+        dbg_printf("found \"%s\" at frame %lu, cycle %lu\n", wait_for, (unsigned long) counters.frames,
+                    (unsigned long) cpu->cycles);
+        return 1;
+    }
+    return 0;
+}
+
+// called once the emulator has stopped, since cutting C64SCR down can move the C64's RAM
+void capture_close(void) {
+    if (text_size) {
+        budget_trim("C64SCR", text_length);
+    }
+    dbg_printf("captured %u screens\n", captures);
+}
+
+#endif
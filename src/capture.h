@@ -0,0 +1,12 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include <stdint.h>
+#include "cpu.h"
+// set to 1 to also save the screen as a picture in C64IMG every time it changes
+#define CAPTURE_IMAGE 0
+void capture_alloc(void);
+void capture_init(void);
+uint8_t capture_frame(cpu_t *cpu);
+uint8_t capture_contains(mem_t *mem, const char *text);
+void capture_close(void);
+#endif
@@ -0,0 +1,81 @@
+#include <graphx.h>
+#include <debug.h>
+#include <stdio.h>
+#include "counters.h"
+#include "graphics.h"
+
+// PAL C64 clock
+static const uint32_t C64_HZ = 985248;
+
+counters_t counters;
+uint8_t hud_visible;
+
+// totals at the start of the current reporting period
+static struct {
+    clock_t time;
+    uint32_t instructions;
+    uint32_t cycles;
+    counters_t counters;
+} last;
+
+static char hud_lines[2][64];
+
+void counters_draw_hud(void) {
+    gfx_SetColor(0);
+    gfx_FillRectangle_NoClip(0, 0, 320, Y_OFFSET);
+    gfx_SetTextFGColor(1);
+    gfx_SetTextBGColor(0);
+    gfx_PrintStringXY(hud_lines[0], 2, 1);
+    gfx_PrintStringXY(hud_lines[1], 2, 11);
+    gfx_BlitLines(gfx_buffer, 0, Y_OFFSET);
+}
+
+void counters_toggle_hud(void) {
+    hud_visible = !hud_visible;
+    if (hud_visible) {
+        counters_draw_hud();
+    } else {
+        // give the top border back
+        vic_mark_border();
+    }
+}
+
+// called once per frame, reports the rates once a second
+void counters_frame(cpu_t *cpu) {
+    clock_t now = clock();
+    clock_t elapsed = now - last.time;
+    if (elapsed < CLOCKS_PER_SEC) {
+        return;
+    }
+    uint32_t instructions = cpu->instructions - last.instructions;
+    uint32_t cycles = cpu->cycles - last.cycles;
+    uint32_t frames = counters.frames - last.counters.frames;
+    clock_t render = counters.render_time - last.counters.render_time;
+    clock_t input = counters.input_time - last.counters.input_time;
+    uint32_t khz = (uint64_t) cycles * CLOCKS_PER_SEC / elapsed / 1000;
+    uint32_t percent = (uint64_t) cycles * CLOCKS_PER_SEC * 100 / elapsed / C64_HZ;
+    uint32_t frame_ms = frames ? (uint32_t) elapsed * 1000 / CLOCKS_PER_SEC / frames : 0;
+    uint8_t render_share = render * 100 / elapsed;
+    uint8_t input_share = input * 100 / elapsed;
+    uint8_t cpu_share = 100 - render_share - input_share;
+
+    dbg_printf("counters instructions=%lu cycles=%lu frames=%lu irqs=%lu screen_writes=%lu cells_redrawn=%lu"
+                " khz=%lu c64=%lu%% frame_ms=%lu cpu=%u%% render=%u%% input=%u%%\n",
+                (unsigned long) instructions, (unsigned long) cycles, (unsigned long) frames,
+                (unsigned long) (counters.irqs - last.counters.irqs),
+                (unsigned long) (counters.screen_writes - last.counters.screen_writes),
+                (unsigned long) (counters.cells_redrawn - last.counters.cells_redrawn),
+                (unsigned long) khz, (unsigned long) percent, (unsigned long) frame_ms,
+                cpu_share, render_share, input_share);
+    sprintf(hud_lines[0], "%lu.%03lu MHz  %lu%% of a C64  %lu ms/frame",
+                (unsigned long) khz / 1000, (unsigned long) khz % 1000, (unsigned long) percent, (unsigned long) frame_ms);
+    sprintf(hud_lines[1], "cpu %u%%  video %u%%  keys %u%%", cpu_share, render_share, input_share);
+    if (hud_visible) {
+        counters_draw_hud();
+    }
+
+    last.time = now;
+    last.instructions = cpu->instructions;
+    last.cycles = cpu->cycles;
+    last.counters = counters;
+}
@@ -0,0 +1,21 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+#include <stdint.h>
+#include <time.h>
+#include "cpu.h"
+typedef struct counters {
+    uint32_t frames;
+    uint32_t irqs;
+    // writes that changed screen or colour RAM
+    uint32_t screen_writes;
+    uint32_t cells_redrawn;
+    // clock ticks spent in vic_refresh and in kb_Scan, the IRQ itself counts as CPU time
+    clock_t render_time;
+    clock_t input_time;
+} counters_t;
+extern counters_t counters;
+extern uint8_t hud_visible;
+void counters_frame(cpu_t *cpu);
+void counters_toggle_hud(void);
+void counters_draw_hud(void);
+#endif
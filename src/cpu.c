@@ -1,5 +1,15 @@
 #include "cpu.h"
 #include "input.h"
+#include "graphics.h"
+#include "counters.h"
+#include "record.h"
+#include "monitor.h"
+#include "reu.h"
+#include "paste.h"
+#include "capture.h"
+#include "sid.h"
+#include "budget.h"
+#include "alu.h"
 #include <graphx.h>
 #include <time.h>
 
@@ -17,27 +27,73 @@ const uint8_t V = 0x40; //0100 0000
 const uint8_t N = 0x80; //1000 0000
 
 const clock_t TIMER_STEP = 16;
+// the CIA timer period on a PAL C64, used instead of the wall clock while recording, replaying or pasting
+const uint32_t IRQ_CYCLES = 16421;
+
+// base cycle count of each opcode, without page crossing penalties. 0 for the opcodes that jam the CPU
+static const uint8_t CYCLES[256] = {
+    7,6,0,8,3,3,5,5,3,2,2,2,4,4,6,6, 2,5,0,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    6,6,0,8,3,3,5,5,4,2,2,2,4,4,6,6, 2,5,0,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    6,6,0,8,3,3,5,5,3,2,2,2,3,4,6,6, 2,5,0,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    6,6,0,8,3,3,5,5,4,2,2,2,5,4,6,6, 2,5,0,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4, 2,6,0,6,4,4,4,4,2,5,2,5,5,5,5,5,
+    2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4, 2,5,0,5,4,4,4,4,2,4,2,4,4,4,4,4,
+    2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6, 2,5,0,8,4,4,6,6,2,4,2,7,4,4,7,7,
+    2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6, 2,5,0,8,4,4,6,6,2,4,2,7,4,4,7,7,
+};
+
+// 32K of the C64's RAM, in an AppVar if there's room or else on the heap. For an AppVar, *ram is only
+// filled in by budget_pointers
+static uint8_t ram_half(const char *name, uint8_t **ram) {
+    if (budget_appvar(name, 0x8000, ram)) {
+        budget_take(name, 0x8000, 0);
+        return 1;
+    }
+    *ram = malloc(0x8000);
+    if (*ram) {
+        budget_take(name, 0x8000, 1);
+    }
+    return *ram != NULL;
+}
 
-cpu_t *init_cpu(uint8_t kern_fp, uint8_t basic_fp, uint8_t char_fp) {
+// Makes room for the C64's RAM, before any other AppVar is made. NULL if there isn't even that much
+cpu_t *alloc_cpu(void) {
     static cpu_t cpu;
     static mem_t memory;
-    uint8_t rama_fp = ti_Open("C64RAMA", "w+");
-    uint8_t ramb_fp = ti_Open("C64RAMB", "w+");
-    ti_Resize(0x8000, rama_fp);
-    ti_Resize(0x8000, ramb_fp);
-    memory.memorya = (uint8_t *)ti_GetDataPtr(rama_fp);
-    memory.memoryb = (uint8_t *)ti_GetDataPtr(ramb_fp);
-    memory.basic_rom = (uint8_t *)ti_GetDataPtr(basic_fp);
-    memory.kernal_rom = (uint8_t *)ti_GetDataPtr(kern_fp);
-    memory.char_rom = (uint8_t *)ti_GetDataPtr(char_fp);
+    if (!ram_half("C64RAMA", &memory.memorya) || !ram_half("C64RAMB", &memory.memoryb)) {
+        return NULL;
+    }
     cpu.memory = &memory;
-    // if you want to enable tracing from the start of execution, set this to 1
-    cpu.trace = 0;
-    cpu.starttime = clock();
-    cpu.timer = 0;
+    memory.cycles = &cpu.cycles;
     return &cpu;
 }
 
+// the rest of the setup, once budget_pointers has found the RAM halves and the REU
+void init_cpu(cpu_t *cpu, uint8_t kern_fp, uint8_t basic_fp, uint8_t char_fp) {
+    mem_t *memory = cpu->memory;
+    cpu->starttime = clock();
+    cpu->timer = 0;
+#ifdef SELFTEST
+    // the self test runs its images in plain RAM and doesn't need the ROMs
+    return;
+#endif
+    memory->basic_rom = (uint8_t *)ti_GetDataPtr(basic_fp);
+    memory->kernal_rom = (uint8_t *)ti_GetDataPtr(kern_fp);
+    memory->char_rom = (uint8_t *)ti_GetDataPtr(char_fp);
+    mem_init(memory);
+#if REU_BANKS
+    reu_init(memory);
+#endif
+#if SHADOW_ROMS
+    mem_shadow_roms(memory);
+#endif
+    // if you want to enable tracing from the start of execution, set this to 1
+    cpu->trace = 0;
+#ifdef ROM_AOT
+    cpu->aot = aot_verify(memory);
+#endif
+}
+
 void cpu_starttrace(cpu_t *cpu) {
     cpu->trace = 1;
 }
@@ -107,20 +163,22 @@ uint16_t cpu_absy(cpu_t *cpu) {
 }
 
 uint16_t cpu_ind(cpu_t *cpu) {
-    uint16_t ind = mem_peek2(cpu->memory, mem_peek2(cpu->memory, cpu->pc));
+    // the NMOS 6502 doesn't carry into the high byte of the pointer, so JMP ($xxFF) reads $xx00
+    uint16_t ind = mem_peek2_page(cpu->memory, mem_peek2(cpu->memory, cpu->pc));
     cpu->pc += 2;
     return ind;
 }
 
 
+// zero page pointers wrap around within the zero page
 uint16_t cpu_indx(cpu_t *cpu) {
-    uint16_t indx = mem_peek2(cpu->memory, mem_peek(cpu->memory, cpu->pc) + cpu->x);
+    uint16_t indx = mem_peek2_page(cpu->memory, (uint8_t) (mem_peek(cpu->memory, cpu->pc) + cpu->x));
     cpu->pc++;
     return indx;
 }
 
 uint16_t cpu_indy(cpu_t *cpu) {
-    uint16_t indy = mem_peek2(cpu->memory, mem_peek(cpu->memory, cpu->pc)) + cpu->y;
+    uint16_t indy = mem_peek2_page(cpu->memory, mem_peek(cpu->memory, cpu->pc)) + cpu->y;
     cpu->pc++;
     return indy;
 }
@@ -153,6 +211,7 @@ void cpu_bfs(cpu_t *cpu, uint8_t flag) {
     // this can be made branchfree by multiplying mem_peek by flagget()
     if (flagset(cpu, flag)) {
         cpu->pc = cpu->pc + ((int8_t) mem_peek(cpu->memory, cpu->pc)) + 1;
+        cpu->cycles++;
     } else {
         cpu->pc++;
     }
@@ -163,6 +222,7 @@ void cpu_bfc(cpu_t *cpu, uint8_t flag) {
         cpu->pc++;
     } else {
         cpu->pc = cpu->pc + ((int8_t) mem_peek(cpu->memory, cpu->pc)) + 1;
+        cpu->cycles++;
     }
 }
 
@@ -198,16 +258,7 @@ void cpu_sty(cpu_t *cpu, uint16_t addr) {
 }
 
 void cpu_adc(cpu_t *cpu, uint16_t addr) {
-    uint16_t h = cpu->a + mem_peek(cpu->memory, addr);
-    if (flagset(cpu, C)) {
-        h++;
-    }
-    cpu->a = h;
-    setflag(cpu, C, h > 0xFF);
-    setflag(cpu, Z, cpu->a == 0);
-    setflag(cpu, N, cpu->a >= 0x80);
-    h += 0x80;
-    setflag(cpu, V, (h > 0xFF) | (h < 0));
+    cpu->a = alu_adc(cpu->a, mem_peek(cpu->memory, addr), &cpu->p);
 }
 
 void cpu_jmp(cpu_t *cpu, uint16_t addr) {
@@ -251,12 +302,12 @@ void cpu_bit(cpu_t *cpu, uint16_t addr) {
 }
 
 void cpu_brk(cpu_t *cpu) {
-    setflag(cpu, B,true);
     cpu->pc++;
     cpu_push(cpu, (uint8_t) HI_16(cpu->pc));
     cpu_push(cpu, (uint8_t) LO_16(cpu->pc));
     cpu->pc--;
-    cpu_push(cpu, cpu->p);
+    // B only exists in the copy of P on the stack
+    cpu_push(cpu, cpu->p | B | 0x20);
     setflag(cpu, I, 0x1);
     cpu->pc = mem_peek2(cpu->memory, 0xFFFE);
 }
@@ -349,6 +400,14 @@ void cpu_ora(cpu_t *cpu, uint16_t addr) {
     setflag(cpu, N, cpu->a >= 0x80);
 }
 
+void cpu_php(cpu_t *cpu) {
+    cpu_push(cpu, cpu->p | B | 0x20);
+}
+
+void cpu_plp(cpu_t *cpu) {
+    cpu->p = cpu_pull(cpu) & ~(B | 0x20);
+}
+
 void cpu_pla(cpu_t *cpu) {
     cpu->a = cpu_pull(cpu);
     setflag(cpu, Z, cpu->a == 0);
@@ -404,7 +463,7 @@ void cpu_ror(cpu_t *cpu, uint16_t addr) {
 }
 
 void cpu_rti(cpu_t *cpu) {
-    cpu->p = cpu_pull(cpu);
+    cpu->p = cpu_pull(cpu) & ~(B | 0x20);
     cpu->pc = cpu_pull(cpu);
     cpu->pc += cpu_pull(cpu) * 0x100;
 }
@@ -415,16 +474,103 @@ void cpu_rts(cpu_t *cpu) {
 }
 
 void cpu_sbc(cpu_t *cpu, uint16_t addr) {
-    uint16_t h = cpu->a - mem_peek(cpu->memory, addr);
-    if (!flagset(cpu, C)) {
-        h--;
-    }
-    cpu->a = h;
+    cpu->a = alu_sbc(cpu->a, mem_peek(cpu->memory, addr), &cpu->p);
+}
+
+// stable undocumented opcodes, which some C64 software relies on
+void cpu_slo(cpu_t *cpu, uint16_t addr) {
+    cpu_asl(cpu, addr);
+    cpu_ora(cpu, addr);
+}
+
+void cpu_rla(cpu_t *cpu, uint16_t addr) {
+    cpu_rol(cpu, addr);
+    cpu_and_(cpu, addr);
+}
+
+void cpu_sre(cpu_t *cpu, uint16_t addr) {
+    cpu_lsr(cpu, addr);
+    cpu_eor(cpu, addr);
+}
+
+void cpu_rra(cpu_t *cpu, uint16_t addr) {
+    cpu_ror(cpu, addr);
+    cpu_adc(cpu, addr);
+}
+
+void cpu_dcp(cpu_t *cpu, uint16_t addr) {
+    cpu_dec_(cpu, addr);
+    cpu_cmp(cpu, addr);
+}
+
+void cpu_isc(cpu_t *cpu, uint16_t addr) {
+    cpu_inc_(cpu, addr);
+    cpu_sbc(cpu, addr);
+}
+
+void cpu_lax(cpu_t *cpu, uint16_t addr) {
+    cpu_lda(cpu, addr);
+    cpu->x = cpu->a;
+}
+
+void cpu_sax(cpu_t *cpu, uint16_t addr) {
+    mem_poke(cpu->memory, addr, cpu->a & cpu->x);
+}
+
+void cpu_anc(cpu_t *cpu, uint16_t addr) {
+    cpu_and_(cpu, addr);
+    setflag(cpu, C, cpu->a & 0x80);
+}
+
+void cpu_alr(cpu_t *cpu, uint16_t addr) {
+    cpu_and_(cpu, addr);
+    cpu_lsr_A(cpu);
+}
+
+void cpu_arr(cpu_t *cpu, uint16_t addr) {
+    cpu_and_(cpu, addr);
+    cpu_ror_A(cpu);
+    setflag(cpu, C, cpu->a & 0x40);
+    setflag(cpu, V, ((cpu->a >> 6) ^ (cpu->a >> 5)) & 0x01);
+}
+
+void cpu_sbx(cpu_t *cpu, uint16_t addr) {
+    uint16_t h = (cpu->a & cpu->x) - mem_peek(cpu->memory, addr);
+    cpu->x = h;
     setflag(cpu, C, h <= 0xFF);
+    setflag(cpu, Z, cpu->x == 0);
+    setflag(cpu, N, cpu->x >= 0x80);
+}
+
+// Unstable undocumented opcodes. ANE and LXA OR A with a constant that depends on the chip and its
+// temperature first, $EE is the common value
+void cpu_ane(cpu_t *cpu, uint16_t addr) {
+    cpu->a = (cpu->a | 0xEE) & cpu->x & mem_peek(cpu->memory, addr);
     setflag(cpu, Z, cpu->a == 0);
     setflag(cpu, N, cpu->a >= 0x80);
-    h += 0x80;
-    setflag(cpu, V, (h > 0xFF) | (h < 0));
+}
+
+void cpu_lxa(cpu_t *cpu, uint16_t addr) {
+    cpu->a = cpu->x = (cpu->a | 0xEE) & mem_peek(cpu->memory, addr);
+    setflag(cpu, Z, cpu->a == 0);
+    setflag(cpu, N, cpu->a >= 0x80);
+}
+
+void cpu_las(cpu_t *cpu, uint16_t addr) {
+    cpu->a = cpu->x = cpu->s = cpu->s & mem_peek(cpu->memory, addr);
+    setflag(cpu, Z, cpu->a == 0);
+    setflag(cpu, N, cpu->a >= 0x80);
+}
+
+// SHA, SHX, SHY and TAS store the value ANDed with the high byte of the base address plus one, and
+// when indexing crosses a page that value replaces the high byte of the address too
+void cpu_sh(cpu_t *cpu, uint16_t base, uint8_t index, uint8_t value) {
+    uint16_t addr = base + index;
+    value &= (base >> 8) + 1;
+    if ((addr ^ base) & 0xFF00) {
+        addr = (addr & 0xFF) | (value << 8);
+    }
+    mem_poke(cpu->memory, addr, value);
 }
 
 void cpu_tax(cpu_t *cpu) {
@@ -461,27 +607,35 @@ void cpu_txs(cpu_t *cpu) {
     cpu->s = cpu->x;
 }
 
+// jump through the IRQ vector unless interrupts are masked, returns 1 if it did
+uint8_t cpu_irq_enter(cpu_t *cpu) {
+    if (flagset(cpu, I)) {
+        return 0;
+    }
+    cpu_push(cpu, (uint8_t) HI_16(cpu->pc));
+    cpu_push(cpu, (uint8_t) LO_16(cpu->pc));
+    cpu_push(cpu, cpu->p | 0x20);
+    setflag(cpu, I, true);
+    cpu->pc = mem_peek2(cpu->memory, 0xFFFE);
+    return 1;
+}
+
 uint8_t cpu_irq(cpu_t *cpu) {
-    if (!flagset(cpu, I)) {
-        setflag(cpu, B,false);
-        cpu_push(cpu, (uint8_t) HI_16(cpu->pc));
-        cpu_push(cpu, (uint8_t) LO_16(cpu->pc));
-        cpu_push(cpu, cpu->p);
-        setflag(cpu, I, true);
-        cpu->pc = mem_peek2(cpu->memory, 0xFFFE);
+    if (cpu_irq_enter(cpu)) {
+        counters.irqs++;
         if (scankey(cpu)) {
             return 1;
         }
     }
     cpu->timer += TIMER_STEP;
+    cpu->next_irq += IRQ_CYCLES;
     return 0;
 }
 
 void cpu_nmi(cpu_t *cpu) {
-    setflag(cpu, B,false);
     cpu_push(cpu, HI_16(cpu->pc));
     cpu_push(cpu, LO_16(cpu->pc));
-    cpu_push(cpu, cpu->p);
+    cpu_push(cpu, cpu->p | 0x20);
     setflag(cpu, I, true);
     cpu->pc = mem_peek2(cpu->memory, 0xFFFA);
 }
@@ -491,179 +645,409 @@ void cpu_reset(cpu_t *cpu) {
     setflag(cpu, I, true);
 }
 
-uint8_t step_cpu(cpu_t *cpu) {
+#ifdef ROM_AOT
+// Addressing modes with the operand already known, for the translated ROM blocks in rom_aot.inc.
+// These have to compute exactly what the cpu_* addressing functions above compute.
+#define AOT_ZPX(zp) ((uint8_t)((zp) + cpu->x))
+#define AOT_ZPY(zp) ((uint8_t)((zp) + cpu->y))
+#define AOT_ABSX(abs) ((uint16_t)((abs) + cpu->x))
+#define AOT_ABSY(abs) ((uint16_t)((abs) + cpu->y))
+#define AOT_IND(abs) mem_peek2_page(cpu->memory, (abs))
+#define AOT_INDX(zp) mem_peek2_page(cpu->memory, (uint8_t)((zp) + cpu->x))
+#define AOT_INDY(zp) ((uint16_t)(mem_peek2_page(cpu->memory, (zp)) + cpu->y))
+// leave a block, either for a known address or with the pc already set by the last instruction
+#define AOT_EXIT(target, count, cost) {cpu->pc = (target); cpu->cycles += (cost); cpu->instructions += (count); return;}
+#define AOT_RETURN(count, cost) {cpu->cycles += (cost); cpu->instructions += (count); return;}
+
+typedef void (*aot_block_t)(cpu_t *cpu);
+typedef struct aot_entry {
+    uint16_t pc;
+    aot_block_t block;
+} aot_entry_t;
+
+// generated by tools/rom2c from the KERNAL and BASIC ROMs
+#include "rom_aot.inc"
+
+uint32_t rom_sum(const uint8_t *rom, uint16_t size) {
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < size; i++) {
+        sum = ((sum << 5) | (sum >> 27)) + rom[i];
+    }
+    return sum;
+}
+
+// the translated blocks are only valid for the exact ROMs they were generated from
+uint8_t aot_verify(mem_t *mem) {
+    if ((rom_sum(mem->kernal_rom, 0x2000) != AOT_KERNAL_SUM) || (rom_sum(mem->basic_rom, 0x2000) != AOT_BASIC_SUM)) {
+        dbg_printf("ROM checksum mismatch, translated blocks disabled\n");
+        return 0;
+    }
+    dbg_printf("%u translated ROM blocks enabled\n", (unsigned int) (sizeof(aot_entries) / sizeof(aot_entries[0])));
+    return 1;
+}
+
+// run the translated block starting at pc, if there is one
+uint8_t aot_run(cpu_t *cpu) {
+    uint16_t pc = cpu->pc;
+    if (pc < 0xA000) {
+        return 0;
+    }
+    uint8_t page = (pc >> 8) - (pc >= 0xE000 ? 0xC0 : 0xA0);
+    if (page >= 0x40) {
+        return 0;
+    }
+    uint16_t low = aot_pages[page];
+    uint16_t high = aot_pages[page + 1];
+    while (low < high) {
+        uint16_t mid = (low + high) / 2;
+        if (aot_entries[mid].pc < pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if ((low == aot_pages[page + 1]) || (aot_entries[low].pc != pc)) {
+        return 0;
+    }
+    aot_entries[low].block(cpu);
+    return 1;
+}
+#endif
+
+// interpret one instruction, returns 1 on an opcode the core doesn't know or when the monitor quits
+uint8_t cpu_exec(cpu_t *cpu) {
     // wait for the C64 to start scanning the keyboard before printing the trace
     // if (cpu->pc == 0xE5CD) {
     //     cpu_starttrace(cpu);
     // }
-    cpu->ir = mem_peek(cpu->memory, cpu->pc);
+    const uint8_t *page = cpu->memory->read_pages[cpu->pc >> 8];
+    if (page) {
+        cpu->ir = page[cpu->pc & 0xFF];
+    } else {
+        // execute breakpoints and stops are only looked for on pages that aren't mapped directly
+        if (monitor_check(cpu)) {
+            return 1;
+        }
+        cpu->ir = mem_peek(cpu->memory, cpu->pc);
+    }
     if (cpu->trace) {
         cpu_dump1(cpu);
     }
     cpu->pc++;
+    cpu->cycles += CYCLES[cpu->ir];
+    cpu->instructions++;
     switch (cpu->ir) {
     case(0x00): {cpu_brk(cpu); break;} //0x00
     case(0x01): {cpu_ora(cpu, cpu_indx(cpu)); break;} //0x01
+    case(0x03): {cpu_slo(cpu, cpu_indx(cpu)); break;} //slo //0x03
+    case(0x04): {cpu_zp(cpu); break;} //nop //0x04
     case(0x05): {cpu_ora(cpu, cpu_zp(cpu)); break;} //0x05
     case(0x06): {cpu_asl(cpu, cpu_zp(cpu)); break;} //0x06
-    case(0x08): {cpu_push(cpu, cpu->p); break;} //0x08
+    case(0x07): {cpu_slo(cpu, cpu_zp(cpu)); break;} //slo //0x07
+    case(0x08): {cpu_php(cpu); break;} //php //0x08
     case(0x09): {cpu_ora(cpu, cpu_imm(cpu)); break;} //0x09
     case(0x0A): {cpu_asl_A(cpu); break;} //0x0A
+    case(0x0B): {cpu_anc(cpu, cpu_imm(cpu)); break;} //anc //0x0B
+    case(0x0C): {cpu_abs(cpu); break;} //nop //0x0C
     case(0x0D): {cpu_ora(cpu, cpu_abs(cpu)); break;} //0x0D
     case(0x0E): {cpu_asl(cpu, cpu_abs(cpu)); break;} //0x0E
+    case(0x0F): {cpu_slo(cpu, cpu_abs(cpu)); break;} //slo //0x0F
     case(0x10): {cpu_bfc(cpu, N); break;} //bpl //0x10
     case(0x11): {cpu_ora(cpu, cpu_indy(cpu)); break;} //0x11
+    case(0x13): {cpu_slo(cpu, cpu_indy(cpu)); break;} //slo //0x13
+    case(0x14): {cpu_zpx(cpu); break;} //nop //0x14
     case(0x15): {cpu_ora(cpu, cpu_zpx(cpu)); break;} //0x15
     case(0x16): {cpu_asl(cpu, cpu_zpx(cpu)); break;} //0x16
+    case(0x17): {cpu_slo(cpu, cpu_zpx(cpu)); break;} //slo //0x17
     case(0x18): {setflag(cpu, C, 0); break;} //clc //0x18
     case(0x19): {cpu_ora(cpu, cpu_absy(cpu)); break;} //0x19
+    case(0x1A): {break;} //nop //0x1A
+    case(0x1B): {cpu_slo(cpu, cpu_absy(cpu)); break;} //slo //0x1B
+    case(0x1C): {cpu_absx(cpu); break;} //nop //0x1C
     case(0x1D): {cpu_ora(cpu, cpu_absx(cpu)); break;} //0x1D
     case(0x1E): {cpu_asl(cpu, cpu_absx(cpu)); break;} //0x1E
+    case(0x1F): {cpu_slo(cpu, cpu_absx(cpu)); break;} //slo //0x1F
     case(0x20): {cpu_jsr(cpu, cpu_abs(cpu)); break;} //0x20
-    case(0x29): {cpu_and_(cpu, cpu_imm(cpu)); break;} //0x29
     case(0x21): {cpu_and_(cpu, cpu_indx(cpu)); break;} //0x21
+    case(0x23): {cpu_rla(cpu, cpu_indx(cpu)); break;} //rla //0x23
     case(0x24): {cpu_bit(cpu, cpu_zp(cpu)); break;} //0x24
     case(0x25): {cpu_and_(cpu, cpu_zp(cpu)); break;} //0x25
     case(0x26): {cpu_rol(cpu, cpu_zp(cpu)); break;} //0x26
-    case(0x28): {cpu_pull(cpu); break;} //plp //0x28
+    case(0x27): {cpu_rla(cpu, cpu_zp(cpu)); break;} //rla //0x27
+    case(0x28): {cpu_plp(cpu); break;} //plp //0x28
+    case(0x29): {cpu_and_(cpu, cpu_imm(cpu)); break;} //0x29
     case(0x2A): {cpu_rol_A(cpu); break;} //0x2A
+    case(0x2B): {cpu_anc(cpu, cpu_imm(cpu)); break;} //anc //0x2B
     case(0x2C): {cpu_bit(cpu, cpu_abs(cpu)); break;} //0x2C
     case(0x2D): {cpu_and_(cpu, cpu_abs(cpu)); break;} //0x2D
     case(0x2E): {cpu_rol(cpu, cpu_abs(cpu)); break;} //0x2E
+    case(0x2F): {cpu_rla(cpu, cpu_abs(cpu)); break;} //rla //0x2F
     case(0x30): {cpu_bfs(cpu, N); break;} //bmi //0x30
     case(0x31): {cpu_and_(cpu, cpu_indy(cpu)); break;} //0x31
+    case(0x33): {cpu_rla(cpu, cpu_indy(cpu)); break;} //rla //0x33
+    case(0x34): {cpu_zpx(cpu); break;} //nop //0x34
     case(0x35): {cpu_and_(cpu, cpu_zpx(cpu)); break;} //0x35
     case(0x36): {cpu_rol(cpu, cpu_zpx(cpu)); break;} //0x36
+    case(0x37): {cpu_rla(cpu, cpu_zpx(cpu)); break;} //rla //0x37
     case(0x38): {setflag(cpu, C, 1); break;}     //sec //0x38
     case(0x39): {cpu_and_(cpu, cpu_absy(cpu)); break;} //0x39
+    case(0x3A): {break;} //nop //0x3A
+    case(0x3B): {cpu_rla(cpu, cpu_absy(cpu)); break;} //rla //0x3B
+    case(0x3C): {cpu_absx(cpu); break;} //nop //0x3C
     case(0x3D): {cpu_and_(cpu, cpu_absx(cpu)); break;} //0x3D
     case(0x3E): {cpu_rol(cpu, cpu_absx(cpu)); break;} //0x3E
+    case(0x3F): {cpu_rla(cpu, cpu_absx(cpu)); break;} //rla //0x3F
     case(0x40): {cpu_rti(cpu); break;} //0x40
     case(0x41): {cpu_eor(cpu, cpu_indx(cpu)); break;} //0x41
+    case(0x43): {cpu_sre(cpu, cpu_indx(cpu)); break;} //sre //0x43
+    case(0x44): {cpu_zp(cpu); break;} //nop //0x44
     case(0x45): {cpu_eor(cpu, cpu_zp(cpu)); break;} //0x45
     case(0x46): {cpu_lsr(cpu, cpu_zp(cpu)); break;} //0x46
+    case(0x47): {cpu_sre(cpu, cpu_zp(cpu)); break;} //sre //0x47
     case(0x48): {cpu_push(cpu, cpu->a); break;} //pha //0x48
     case(0x49): {cpu_eor(cpu, cpu_imm(cpu)); break;} //0x49
     case(0x4A): {cpu_lsr_A(cpu); break;} //0x4A
+    case(0x4B): {cpu_alr(cpu, cpu_imm(cpu)); break;} //alr //0x4B
     case(0x4C): {cpu_jmp(cpu, cpu_abs(cpu)); break;} //0x4C
     case(0x4D): {cpu_eor(cpu, cpu_abs(cpu)); break;} //0x4D
     case(0x4E): {cpu_lsr(cpu, cpu_abs(cpu)); break;} //0x4E
+    case(0x4F): {cpu_sre(cpu, cpu_abs(cpu)); break;} //sre //0x4F
     case(0x50): {cpu_bfc(cpu, V); break;} //bvc //0x50
     case(0x51): {cpu_eor(cpu, cpu_indy(cpu)); break;} //0x51
+    case(0x53): {cpu_sre(cpu, cpu_indy(cpu)); break;} //sre //0x53
+    case(0x54): {cpu_zpx(cpu); break;} //nop //0x54
     case(0x55): {cpu_eor(cpu, cpu_zpx(cpu)); break;} //0x55
     case(0x56): {cpu_lsr(cpu, cpu_zpx(cpu)); break;} //0x56
+    case(0x57): {cpu_sre(cpu, cpu_zpx(cpu)); break;} //sre //0x57
     case(0x58): {setflag(cpu, I, 0); break;} //cli //0x58
     case(0x59): {cpu_eor(cpu, cpu_absy(cpu)); break;} //0x59
+    case(0x5A): {break;} //nop //0x5A
+    case(0x5B): {cpu_sre(cpu, cpu_absy(cpu)); break;} //sre //0x5B
+    case(0x5C): {cpu_absx(cpu); break;} //nop //0x5C
     case(0x5D): {cpu_eor(cpu, cpu_absx(cpu)); break;} //0x5D
     case(0x5E): {cpu_lsr(cpu, cpu_absx(cpu)); break;} //0x5E
+    case(0x5F): {cpu_sre(cpu, cpu_absx(cpu)); break;} //sre //0x5F
     case(0x60): {cpu_rts(cpu); break;} //0x60
     case(0x61): {cpu_adc(cpu, cpu_indx(cpu)); break;} //0x61
+    case(0x63): {cpu_rra(cpu, cpu_indx(cpu)); break;} //rra //0x63
+    case(0x64): {cpu_zp(cpu); break;} //nop //0x64
     case(0x65): {cpu_adc(cpu, cpu_zp(cpu)); break;} //0x65
     case(0x66): {cpu_ror(cpu, cpu_zp(cpu)); break;} //0x66
+    case(0x67): {cpu_rra(cpu, cpu_zp(cpu)); break;} //rra //0x67
     case(0x68): {cpu_pla(cpu); break;} //0x68
     case(0x69): {cpu_adc(cpu, cpu_imm(cpu)); break;} //0x69
     case(0x6A): {cpu_ror_A(cpu); break;} //0x6A
+    case(0x6B): {cpu_arr(cpu, cpu_imm(cpu)); break;} //arr //0x6B
     case(0x6C): {cpu_jmp(cpu, cpu_ind(cpu)); break;} //0x6C
     case(0x6D): {cpu_adc(cpu, cpu_abs(cpu)); break;} //0x6D
     case(0x6E): {cpu_ror(cpu, cpu_abs(cpu)); break;} //0x6E
+    case(0x6F): {cpu_rra(cpu, cpu_abs(cpu)); break;} //rra //0x6F
     case(0x70): {cpu_bfs(cpu, V); break;} //bvs //0x70
     case(0x71): {cpu_adc(cpu, cpu_indy(cpu)); break;} //0x71
+    case(0x73): {cpu_rra(cpu, cpu_indy(cpu)); break;} //rra //0x73
+    case(0x74): {cpu_zpx(cpu); break;} //nop //0x74
     case(0x75): {cpu_adc(cpu, cpu_zpx(cpu)); break;} //0x75
     case(0x76): {cpu_ror(cpu, cpu_zpx(cpu)); break;} //0x76
+    case(0x77): {cpu_rra(cpu, cpu_zpx(cpu)); break;} //rra //0x77
     case(0x78): {setflag(cpu, I, 1); break;}     //sei //0x78
     case(0x79): {cpu_adc(cpu, cpu_absy(cpu)); break;} //0x79
+    case(0x7A): {break;} //nop //0x7A
+    case(0x7B): {cpu_rra(cpu, cpu_absy(cpu)); break;} //rra //0x7B
+    case(0x7C): {cpu_absx(cpu); break;} //nop //0x7C
     case(0x7D): {cpu_adc(cpu, cpu_absx(cpu)); break;} //0x7D
     case(0x7E): {cpu_ror(cpu, cpu_absx(cpu)); break;} //0x7E
+    case(0x7F): {cpu_rra(cpu, cpu_absx(cpu)); break;} //rra //0x7F
+    case(0x80): {cpu_imm(cpu); break;} //nop //0x80
     case(0x81): {cpu_sta(cpu, cpu_indx(cpu)); break;} //0x81
+    case(0x82): {cpu_imm(cpu); break;} //nop //0x82
+    case(0x83): {cpu_sax(cpu, cpu_indx(cpu)); break;} //sax //0x83
     case(0x84): {cpu_sty(cpu, cpu_zp(cpu)); break;} //0x84
     case(0x85): {cpu_sta(cpu, cpu_zp(cpu)); break;} //0x85
     case(0x86): {cpu_stx(cpu, cpu_zp(cpu)); break;} //0x86
+    case(0x87): {cpu_sax(cpu, cpu_zp(cpu)); break;} //sax //0x87
     case(0x88): {cpu_dey(cpu); break;} //0x88
+    case(0x89): {cpu_imm(cpu); break;} //nop //0x89
     case(0x8A): {cpu_txa(cpu); break;} //0x8A
+    case(0x8B): {cpu_ane(cpu, cpu_imm(cpu)); break;} //ane //0x8B
     case(0x8C): {cpu_sty(cpu, cpu_abs(cpu)); break;} //0x8C
     case(0x8D): {cpu_sta(cpu, cpu_abs(cpu)); break;} //0x8D
     case(0x8E): {cpu_stx(cpu, cpu_abs(cpu)); break;} //0x8E
+    case(0x8F): {cpu_sax(cpu, cpu_abs(cpu)); break;} //sax //0x8F
     case(0x90): {cpu_bfc(cpu, C); break;} //bcc //0x90
     case(0x91): {cpu_sta(cpu, cpu_indy(cpu)); break;} //0x91
+    case(0x93): {cpu_sh(cpu, mem_peek2_page(cpu->memory, cpu_zp(cpu)), cpu->y, cpu->a & cpu->x); break;} //sha //0x93
     case(0x94): {cpu_sty(cpu, cpu_zpx(cpu)); break;} //0x94
     case(0x95): {cpu_sta(cpu, cpu_zpx(cpu)); break;} //0x95
     case(0x96): {cpu_stx(cpu, cpu_zpy(cpu)); break;} //0x96
+    case(0x97): {cpu_sax(cpu, cpu_zpy(cpu)); break;} //sax //0x97
     case(0x98): {cpu_tya(cpu); break;} //0x98
     case(0x99): {cpu_sta(cpu, cpu_absy(cpu)); break;} //0x99
     case(0x9A): {cpu_txs(cpu); break;} //0x9A
+    case(0x9B): {cpu->s = cpu->a & cpu->x; cpu_sh(cpu, cpu_abs(cpu), cpu->y, cpu->s); break;} //tas //0x9B
+    case(0x9C): {cpu_sh(cpu, cpu_abs(cpu), cpu->x, cpu->y); break;} //shy //0x9C
     case(0x9D): {cpu_sta(cpu, cpu_absx(cpu)); break;} //0x9D
+    case(0x9E): {cpu_sh(cpu, cpu_abs(cpu), cpu->y, cpu->x); break;} //shx //0x9E
+    case(0x9F): {cpu_sh(cpu, cpu_abs(cpu), cpu->y, cpu->a & cpu->x); break;} //sha //0x9F
     case(0xA0): {cpu_ldy(cpu, cpu_imm(cpu)); break;} //0xA0
     case(0xA1): {cpu_lda(cpu, cpu_indx(cpu)); break;} //0xA1
     case(0xA2): {cpu_ldx(cpu, cpu_imm(cpu)); break;} //0xA2
+    case(0xA3): {cpu_lax(cpu, cpu_indx(cpu)); break;} //lax //0xA3
     case(0xA4): {cpu_ldy(cpu, cpu_zp(cpu)); break;} //0xA4
     case(0xA5): {cpu_lda(cpu, cpu_zp(cpu)); break;} //0xA5
     case(0xA6): {cpu_ldx(cpu, cpu_zp(cpu)); break;} //0xA6
+    case(0xA7): {cpu_lax(cpu, cpu_zp(cpu)); break;} //lax //0xA7
     case(0xA8): {cpu_tay(cpu); break;} //0xA8
     case(0xA9): {cpu_lda(cpu, cpu_imm(cpu)); break;} //0xA9
     case(0xAA): {cpu_tax(cpu); break;} //0xAA
+    case(0xAB): {cpu_lxa(cpu, cpu_imm(cpu)); break;} //lxa //0xAB
     case(0xAC): {cpu_ldy(cpu, cpu_abs(cpu)); break;} //0xAC
     case(0xAD): {cpu_lda(cpu, cpu_abs(cpu)); break;} //0xAD
     case(0xAE): {cpu_ldx(cpu, cpu_abs(cpu)); break;} //0xAE
+    case(0xAF): {cpu_lax(cpu, cpu_abs(cpu)); break;} //lax //0xAF
     case(0xB0): {cpu_bfs(cpu, C); break;} //bcs //0xB0
     case(0xB1): {cpu_lda(cpu, cpu_indy(cpu)); break;} //0xB1
+    case(0xB3): {cpu_lax(cpu, cpu_indy(cpu)); break;} //lax //0xB3
     case(0xB4): {cpu_ldy(cpu, cpu_zpx(cpu)); break;} //0xB4
     case(0xB5): {cpu_lda(cpu, cpu_zpx(cpu)); break;} //0xB5
     case(0xB6): {cpu_ldx(cpu, cpu_zpy(cpu)); break;} //0xB6
+    case(0xB7): {cpu_lax(cpu, cpu_zpy(cpu)); break;} //lax //0xB7
     case(0xB8): {setflag(cpu, V, 0); break;} //clv //0xB8
     case(0xB9): {cpu_lda(cpu, cpu_absy(cpu)); break;} //0xB9
     case(0xBA): {cpu_tsx(cpu); break;} //0xBA
+    case(0xBB): {cpu_las(cpu, cpu_absy(cpu)); break;} //las //0xBB
     case(0xBC): {cpu_ldy(cpu, cpu_absx(cpu)); break;} //0xBC
     case(0xBD): {cpu_lda(cpu, cpu_absx(cpu)); break;} //0xBD
     case(0xBE): {cpu_ldx(cpu, cpu_absy(cpu)); break;} //0xBE
+    case(0xBF): {cpu_lax(cpu, cpu_absy(cpu)); break;} //lax //0xBF
     case(0xC0): {cpu_cpy(cpu, cpu_imm(cpu)); break;} //0xC0
     case(0xC1): {cpu_cmp(cpu, cpu_indx(cpu)); break;} //0xC1
+    case(0xC2): {cpu_imm(cpu); break;} //nop //0xC2
+    case(0xC3): {cpu_dcp(cpu, cpu_indx(cpu)); break;} //dcp //0xC3
     case(0xC4): {cpu_cpy(cpu, cpu_zp(cpu)); break;} //0xC4
     case(0xC5): {cpu_cmp(cpu, cpu_zp(cpu)); break;} //0xC5
     case(0xC6): {cpu_dec_(cpu, cpu_zp(cpu)); break;} //0xC6
+    case(0xC7): {cpu_dcp(cpu, cpu_zp(cpu)); break;} //dcp //0xC7
     case(0xC8): {cpu_iny(cpu); break;} //0xC8
     case(0xC9): {cpu_cmp(cpu, cpu_imm(cpu)); break;} //0xC9
     case(0xCA): {cpu_dex(cpu); break;} //0xCA
+    case(0xCB): {cpu_sbx(cpu, cpu_imm(cpu)); break;} //sbx //0xCB
     case(0xCC): {cpu_cpy(cpu, cpu_abs(cpu)); break;} //0xCC
     case(0xCD): {cpu_cmp(cpu, cpu_abs(cpu)); break;} //0xCD
     case(0xCE): {cpu_dec_(cpu, cpu_abs(cpu)); break;} //0xCE
+    case(0xCF): {cpu_dcp(cpu, cpu_abs(cpu)); break;} //dcp //0xCF
     case(0xD0): {cpu_bfc(cpu, Z); break;} //bne //0xD0
     case(0xD1): {cpu_cmp(cpu, cpu_indy(cpu)); break;} //0xD1
+    case(0xD3): {cpu_dcp(cpu, cpu_indy(cpu)); break;} //dcp //0xD3
+    case(0xD4): {cpu_zpx(cpu); break;} //nop //0xD4
     case(0xD5): {cpu_cmp(cpu, cpu_zpx(cpu)); break;} //0xD5
     case(0xD6): {cpu_dec_(cpu, cpu_zpx(cpu)); break;} //0xD6
+    case(0xD7): {cpu_dcp(cpu, cpu_zpx(cpu)); break;} //dcp //0xD7
     case(0xD8): {setflag(cpu, D, 0); break;} //cld //0xD8
     case(0xD9): {cpu_cmp(cpu, cpu_absy(cpu)); break;} //0xD9
+    case(0xDA): {break;} //nop //0xDA
+    case(0xDB): {cpu_dcp(cpu, cpu_absy(cpu)); break;} //dcp //0xDB
+    case(0xDC): {cpu_absx(cpu); break;} //nop //0xDC
     case(0xDD): {cpu_cmp(cpu, cpu_absx(cpu)); break;} //0xDD
     case(0xDE): {cpu_dec_(cpu, cpu_absx(cpu)); break;} //0xDE
+    case(0xDF): {cpu_dcp(cpu, cpu_absx(cpu)); break;} //dcp //0xDF
     case(0xE0): {cpu_cpx(cpu, cpu_imm(cpu)); break;} //0xE0
     case(0xE1): {cpu_sbc(cpu, cpu_indx(cpu)); break;} //0xE1
+    case(0xE2): {cpu_imm(cpu); break;} //nop //0xE2
+    case(0xE3): {cpu_isc(cpu, cpu_indx(cpu)); break;} //isc //0xE3
     case(0xE4): {cpu_cpx(cpu, cpu_zp(cpu)); break;} //0xE4
     case(0xE5): {cpu_sbc(cpu, cpu_zp(cpu)); break;} //0xE5
     case(0xE6): {cpu_inc_(cpu, cpu_zp(cpu)); break;} //0xE6
+    case(0xE7): {cpu_isc(cpu, cpu_zp(cpu)); break;} //isc //0xE7
     case(0xE8): {cpu_inx(cpu); break;} //0xE8
     case(0xE9): {cpu_sbc(cpu, cpu_imm(cpu)); break;} //0xE9
-    case(0xEC): {cpu_cpx(cpu, cpu_abs(cpu)); break;} //0xEC
     case(0xEA): {break;} //0xEA
+    case(0xEB): {cpu_sbc(cpu, cpu_imm(cpu)); break;} //sbc //0xEB
+    case(0xEC): {cpu_cpx(cpu, cpu_abs(cpu)); break;} //0xEC
     case(0xED): {cpu_sbc(cpu, cpu_abs(cpu)); break;} //0xED
     case(0xEE): {cpu_inc_(cpu, cpu_abs(cpu)); break;} //0xEE
+    case(0xEF): {cpu_isc(cpu, cpu_abs(cpu)); break;} //isc //0xEF
     case(0xF0): {cpu_bfs(cpu, Z); break;} //beq //0xF0
     case(0xF1): {cpu_sbc(cpu, cpu_indy(cpu)); break;} //0xF1
+    case(0xF3): {cpu_isc(cpu, cpu_indy(cpu)); break;} //isc //0xF3
+    case(0xF4): {cpu_zpx(cpu); break;} //nop //0xF4
     case(0xF5): {cpu_sbc(cpu, cpu_zpx(cpu)); break;} //0xF5
     case(0xF6): {cpu_inc_(cpu, cpu_zpx(cpu)); break;} //0xF6
+    case(0xF7): {cpu_isc(cpu, cpu_zpx(cpu)); break;} //isc //0xF7
     case(0xF8): {setflag(cpu, D, 1); break;}     //sed //0xF8
     case(0xF9): {cpu_sbc(cpu, cpu_absy(cpu)); break;} //0xF9
+    case(0xFA): {break;} //nop //0xFA
+    case(0xFB): {cpu_isc(cpu, cpu_absy(cpu)); break;} //isc //0xFB
+    case(0xFC): {cpu_absx(cpu); break;} //nop //0xFC
     case(0xFD): {cpu_sbc(cpu, cpu_absx(cpu)); break;} //0xFD
     case(0xFE): {cpu_inc_(cpu, cpu_absx(cpu)); break;} //0xFE
+    case(0xFF): {cpu_isc(cpu, cpu_absx(cpu)); break;} //isc //0xFF
     default: return 1;
     }
     if (cpu->trace) {
         cpu_dump2(cpu);
     }
+    return 0;
+}
+
+uint8_t step_cpu(cpu_t *cpu) {
+    uint8_t translated = 0;
+#ifdef ROM_AOT
+    translated = cpu->aot && !cpu->trace && !monitor_stop && !monitor_active && aot_run(cpu);
+#endif
+    if (!translated && cpu_exec(cpu)) {
+        return 1;
+    }
 
-    if ((clock() - cpu->starttime) / CLOCKS_PER_SEC * 1000 > cpu->timer) {
-        if (cpu_irq(cpu)) {
+#ifndef SELFTEST
+    uint8_t due;
+    // set while a paste runs on emulated time
+    static uint8_t warped;
+    if (record_mode) {
+        due = cpu->cycles >= cpu->next_irq;
+    } else if (PASTE_WARP && paste_active) {
+        if (!warped) {
+            cpu->next_irq = cpu->cycles + IRQ_CYCLES;
+            warped = 1;
+        }
+        due = cpu->cycles >= cpu->next_irq;
+        // top the keyboard buffer up as soon as the editor has taken it all, not only on the next IRQ
+        if (!due && !cpu->memory->memorya[0xC6]) {
+            paste_fill(cpu->memory);
+        }
+    } else {
+        if (warped) {
+            // the wall clock takes over again from now
+            cpu->timer = (clock() - cpu->starttime) / CLOCKS_PER_SEC * 1000;
+            warped = 0;
+        }
+        due = (clock() - cpu->starttime) / CLOCKS_PER_SEC * 1000 > cpu->timer;
+    }
+    if (due) {
+        // where the C64 was running, before cpu_irq points the pc at its handler
+        uint16_t interrupted = cpu->pc;
+        clock_t start = clock();
+        // the screen catches up once a paste is done
+        if (!(PASTE_WARP && paste_active)) {
+            vic_refresh(cpu->memory);
+        }
+        counters.render_time += clock() - start;
+        uint8_t quit = cpu_irq(cpu);
+#ifdef AUDIO
+        sid_frame(cpu->cycles);
+#endif
+        counters.frames++;
+        counters_frame(cpu);
+#if SHADOW_ROMS
+        mem_shadow_tick(cpu->memory, interrupted, counters.frames);
+#endif
+#ifdef CAPTURE
+        quit = quit || capture_frame(cpu);
+#endif
+        if (quit) {
             return 1;
         }
     }
+#endif
 
     return 0;
 }
\ No newline at end of file
@@ -19,11 +19,25 @@ typedef struct cpu
     uint16_t pc;
     mem_t *memory;
     uint8_t trace;
+    // emulated cycles and instructions since power on
+    uint32_t cycles;
+    uint32_t instructions;
+    // set when the translated ROM blocks match the loaded ROMs
+    uint8_t aot;
     clock_t starttime;
     clock_t timer;
+    // cycle count of the next IRQ when the wall clock isn't used
+    uint32_t next_irq;
 } cpu_t;
-cpu_t *init_cpu(uint8_t kern_fp, uint8_t basic_fp, uint8_t char_fp);
+cpu_t *alloc_cpu(void);
+void init_cpu(cpu_t *cpu, uint8_t kern_fp, uint8_t basic_fp, uint8_t char_fp);
 uint8_t step_cpu(cpu_t *cpu);
+uint8_t cpu_exec(cpu_t *cpu);
+uint8_t cpu_irq_enter(cpu_t *cpu);
+#ifdef ROM_AOT
+uint8_t aot_verify(mem_t *mem);
+uint8_t aot_run(cpu_t *cpu);
+#endif
 void cpu_start(cpu_t *cpu);
 void dump_cpu(cpu_t *cpu);
 void load_sample_program(cpu_t *cpu);
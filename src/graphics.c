@@ -1,48 +1,385 @@
 #include "graphics.h"
 #include "memory.h"
+#include "sprite.h"
+#include "counters.h"
 #include <graphx.h>
 #include <debug.h>
+#include <string.h>
 
 const uint16_t Y_OFFSET = 20;
 
+// one bit per text cell, 40 cells per row packed into 5 bytes
+static uint8_t dirty[25][5];
+static uint8_t row_dirty[25];
+static uint8_t border_dirty;
+static uint8_t all_dirty;
+
+// hash of the screen and colour RAM each text row was last drawn from, used to spot scrolling, and
+// a copy of those bytes, 40 screen codes then 20 packed colours, to check a match is real
+static uint32_t row_hash[25];
+static uint8_t row_copy[25][60];
+uint32_t vic_scrolls;
+uint32_t vic_cells_saved;
+
+// 0xFF/0x00 pixel masks for each bit of a hi-res byte
+static uint8_t hires_mask[256][8];
+// colour index of each pixel pair of a multicolour byte
+static uint8_t mc_index[256][4];
+
 void graphics_init() {
     gfx_Begin();
     gfx_SetDrawBuffer();
     gfx_ZeroScreen();
-    gfx_palette[0] = gfx_RGBTo1555(0,0,0);
-    gfx_palette[1] = gfx_RGBTo1555(255,255,255);
-    gfx_palette[2] = gfx_RGBTo1555(255,0,0);
-    gfx_palette[3] = gfx_RGBTo1555(0,255,255);
-    gfx_palette[4] = gfx_RGBTo1555(255,0,255);
-    gfx_palette[5] = gfx_RGBTo1555(0,255,0);
-    gfx_palette[6] = gfx_RGBTo1555(0,0,255);
-    gfx_palette[7] = gfx_RGBTo1555(255,255,0);
-    gfx_palette[8] = gfx_RGBTo1555(0xFF,0xA5,0x00);
-    gfx_palette[9] = gfx_RGBTo1555(0xA5,0x2A,0x2A);
-    gfx_palette[10] = gfx_RGBTo1555(0xff,0xcc,0xcb);
-    gfx_palette[11] = gfx_RGBTo1555(64,64,64);
-    gfx_palette[12] = gfx_RGBTo1555(128,128,128);
-    gfx_palette[13] = gfx_RGBTo1555(0x90, 0xEE, 0x90);
-    gfx_palette[14] = gfx_RGBTo1555(0xad,0xd8,0xe6);
-    gfx_palette[15] = gfx_RGBTo1555(192,192,192);
+    // the "Pepto" PAL palette
+    gfx_palette[0] = gfx_RGBTo1555(0x00,0x00,0x00);
+    gfx_palette[1] = gfx_RGBTo1555(0xFF,0xFF,0xFF);
+    gfx_palette[2] = gfx_RGBTo1555(0x68,0x37,0x2B);
+    gfx_palette[3] = gfx_RGBTo1555(0x70,0xA4,0xB2);
+    gfx_palette[4] = gfx_RGBTo1555(0x6F,0x3D,0x86);
+    gfx_palette[5] = gfx_RGBTo1555(0x58,0x8D,0x43);
+    gfx_palette[6] = gfx_RGBTo1555(0x35,0x28,0x79);
+    gfx_palette[7] = gfx_RGBTo1555(0xB8,0xC7,0x6F);
+    gfx_palette[8] = gfx_RGBTo1555(0x6F,0x4F,0x25);
+    gfx_palette[9] = gfx_RGBTo1555(0x43,0x39,0x00);
+    gfx_palette[10] = gfx_RGBTo1555(0x9A,0x67,0x59);
+    gfx_palette[11] = gfx_RGBTo1555(0x44,0x44,0x44);
+    gfx_palette[12] = gfx_RGBTo1555(0x6C,0x6C,0x6C);
+    gfx_palette[13] = gfx_RGBTo1555(0x9A,0xD2,0x84);
+    gfx_palette[14] = gfx_RGBTo1555(0x6C,0x5E,0xB5);
+    gfx_palette[15] = gfx_RGBTo1555(0x95,0x95,0x95);
+    vic_tables_init();
+    vic_mark_all();
+    vic_mark_border();
 }
 
 void graphics_close() {
     gfx_End();
 }
 
+void vic_mark(uint16_t pos) {
+    uint8_t row = pos / 40;
+    uint8_t col = pos % 40;
+    dirty[row][col >> 3] |= 1 << (col & 7);
+    row_dirty[row] = 1;
+}
+
+void vic_mark_all() {
+    memset(dirty, 0xFF, sizeof(dirty));
+    memset(row_dirty, 1, sizeof(row_dirty));
+    all_dirty = 1;
+}
+
+// mark cells first to last - 1, for block writes
+void vic_mark_span(uint16_t first, uint16_t last) {
+    uint8_t row = first / 40;
+    uint8_t col = first % 40;
+    for (uint16_t pos = first; pos < last; pos++) {
+        dirty[row][col >> 3] |= 1 << (col & 7);
+        row_dirty[row] = 1;
+        if (++col == 40) {
+            col = 0;
+            row++;
+        }
+    }
+}
+
+void vic_mark_border() {
+    border_dirty = 1;
+}
+
+// mark the cells under a rectangle given in display pixels, clipped to the screen
+void vic_mark_rect(int16_t x, int16_t y, uint8_t width, uint8_t height) {
+    int16_t col0 = x < 0 ? 0 : x / 8;
+    int16_t col1 = x + width > 320 ? 40 : (x + width + 7) / 8;
+    int16_t row0 = y < 0 ? 0 : y / 8;
+    int16_t row1 = y + height > 200 ? 25 : (y + height + 7) / 8;
+    for (int16_t row = row0; row < row1; row++) {
+        for (int16_t col = col0; col < col1; col++) {
+            dirty[row][col >> 3] |= 1 << (col & 7);
+        }
+        row_dirty[row] = 1;
+    }
+}
+
+uint8_t vic_rect_dirty(int16_t x, int16_t y, uint8_t width, uint8_t height) {
+    int16_t col0 = x < 0 ? 0 : x / 8;
+    int16_t col1 = x + width > 320 ? 40 : (x + width + 7) / 8;
+    int16_t row0 = y < 0 ? 0 : y / 8;
+    int16_t row1 = y + height > 200 ? 25 : (y + height + 7) / 8;
+    for (int16_t row = row0; row < row1; row++) {
+        if (!row_dirty[row]) {
+            continue;
+        }
+        for (int16_t col = col0; col < col1; col++) {
+            if (dirty[row][col >> 3] & (1 << (col & 7))) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void vic_tables_init() {
+    for (uint16_t byte = 0; byte < 256; byte++) {
+        for (uint8_t x = 0; x < 8; x++) {
+            hires_mask[byte][x] = (byte & (0x80 >> x)) ? 0xFF : 0x00;
+        }
+        for (uint8_t x = 0; x < 4; x++) {
+            mc_index[byte][x] = (byte >> (6 - x * 2)) & 0x03;
+        }
+    }
+}
+
+// expand one hi-res byte to 8 pixels of fg/bg, four at a time
+static void draw_hires(uint8_t *dst, uint8_t bits, uint32_t fg4, uint32_t bg4) {
+    uint32_t mask[2];
+    memcpy(mask, hires_mask[bits], 8);
+    mask[0] = bg4 ^ (mask[0] & (fg4 ^ bg4));
+    mask[1] = bg4 ^ (mask[1] & (fg4 ^ bg4));
+    memcpy(dst, mask, 8);
+}
+
+// expand one multicolour byte to 4 double-wide pixels
+static void draw_multicolor(uint8_t *dst, uint8_t bits, const uint16_t *pairs) {
+    const uint8_t *index = mc_index[bits];
+    uint16_t out[4] = {pairs[index[0]], pairs[index[1]], pairs[index[2]], pairs[index[3]]};
+    memcpy(dst, out, 8);
+}
+
 void vic_text(mem_t *mem, uint16_t pos, uint8_t val) {
+    uint8_t *regs = mem->vic;
     uint16_t x0 = (pos % 40) * 8;
     uint16_t y0 = (pos / 40) * 8 + Y_OFFSET;
-    for (uint8_t x = 0; x < 8; x++) {
-        for (uint8_t y = 0; y < 8; y++) {
-            if (vic_peek(mem, 0x1000+val*8+y) & (0x80 >> x)) {
-                gfx_SetColor(14);
-            } else {
-                gfx_SetColor(6);
+    uint16_t glyph = ((regs[0x18] & 0x0E) << 10) + val * 8;
+    uint8_t fg = color_peek(mem, pos);
+    uint8_t bg = regs[0x21] & 0x0F;
+    uint8_t *dst = &(*gfx_vbuffer)[y0][x0];
+    if (regs[0x11] & 0x40) {
+        // extended colour mode: the top two bits of the code pick one of four backgrounds
+        glyph -= (val & 0xC0) * 8;
+        bg = regs[0x21 + (val >> 6)] & 0x0F;
+        if (regs[0x16] & 0x10) {
+            // ECM and MCM together is an invalid mode that displays black
+            fg = bg = 0;
+        }
+    } else if ((regs[0x16] & 0x10) && (fg & 0x08)) {
+        // multicolour text: pixel pairs pick the background, $D022, $D023 or the cell colour
+        uint16_t pairs[4] = {bg * 0x0101, (regs[0x22] & 0x0F) * 0x0101, (regs[0x23] & 0x0F) * 0x0101, (fg & 0x07) * 0x0101};
+        for (uint8_t y = 0; y < 8; y++, dst += 320) {
+            draw_multicolor(dst, vic_peek(mem, glyph + y), pairs);
+        }
+        return;
+    }
+    uint32_t fg4 = fg * 0x01010101UL;
+    uint32_t bg4 = bg * 0x01010101UL;
+    for (uint8_t y = 0; y < 8; y++, dst += 320) {
+        draw_hires(dst, vic_peek(mem, glyph + y), fg4, bg4);
+    }
+}
+
+void vic_bitmap(mem_t *mem, uint16_t pos) {
+    uint8_t *regs = mem->vic;
+    uint16_t x0 = (pos % 40) * 8;
+    uint16_t y0 = (pos / 40) * 8 + Y_OFFSET;
+    uint16_t bitmap = ((regs[0x18] & 0x08) << 10) + pos * 8;
+    uint8_t screen = mem->memorya[0x400 + pos];
+    uint8_t *dst = &(*gfx_vbuffer)[y0][x0];
+    if (regs[0x11] & 0x40) {
+        // ECM with a bitmap mode is invalid and displays black
+        memset(dst, 0, 8);
+        for (uint8_t y = 1; y < 8; y++) {
+            memset(dst + y * 320, 0, 8);
+        }
+    } else if (regs[0x16] & 0x10) {
+        uint16_t pairs[4] = {(regs[0x21] & 0x0F) * 0x0101, (screen >> 4) * 0x0101, (screen & 0x0F) * 0x0101, color_peek(mem, pos) * 0x0101};
+        for (uint8_t y = 0; y < 8; y++, dst += 320) {
+            draw_multicolor(dst, vic_peek(mem, bitmap + y), pairs);
+        }
+    } else {
+        uint32_t fg4 = (screen >> 4) * 0x01010101UL;
+        uint32_t bg4 = (screen & 0x0F) * 0x01010101UL;
+        for (uint8_t y = 0; y < 8; y++, dst += 320) {
+            draw_hires(dst, vic_peek(mem, bitmap + y), fg4, bg4);
+        }
+    }
+}
+
+// foreground pixels of one pixel row of a cell, as used for sprite priority and collisions
+uint8_t vic_foreground(mem_t *mem, uint8_t col, uint8_t y) {
+    uint8_t *regs = mem->vic;
+    uint16_t pos = (y >> 3) * 40 + col;
+    uint8_t multicolor = regs[0x16] & 0x10;
+    uint8_t bits;
+    if (regs[0x11] & 0x20) {
+        bits = vic_peek(mem, ((regs[0x18] & 0x08) << 10) + pos * 8 + (y & 7));
+    } else {
+        uint8_t val = mem->memorya[0x400 + pos];
+        if (regs[0x11] & 0x40) {
+            val &= 0x3F;
+        }
+        bits = vic_peek(mem, ((regs[0x18] & 0x0E) << 10) + val * 8 + (y & 7));
+        multicolor = multicolor && (color_peek(mem, pos) & 0x08);
+    }
+    if (multicolor) {
+        // pairs 10 and 11 count as foreground, 01 is background
+        bits &= 0xAA;
+        bits |= bits >> 1;
+    }
+    return bits;
+}
+
+// FNV-1a, so rows that only differ by where a byte sits don't share a hash
+static uint32_t text_row_hash(mem_t *mem, uint8_t row) {
+    const uint8_t *screen = &mem->memorya[0x400 + row * 40];
+    const uint8_t *color = &mem->color_ram[row * 20];
+    uint32_t hash = 2166136261UL;
+    for (uint8_t i = 0; i < 40; i++) {
+        hash = (hash ^ screen[i]) * 16777619UL;
+    }
+    for (uint8_t i = 0; i < 20; i++) {
+        hash = (hash ^ color[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+// what a text row is drawn from, kept so a row whose hash matches can be checked byte for byte
+static void save_row(mem_t *mem, uint8_t row) {
+    row_hash[row] = text_row_hash(mem, row);
+    memcpy(row_copy[row], &mem->memorya[0x400 + row * 40], 40);
+    memcpy(row_copy[row] + 40, &mem->color_ram[row * 20], 20);
+}
+
+static uint8_t same_row(mem_t *mem, uint8_t row, const uint8_t *copy) {
+    return !memcmp(copy, &mem->memorya[0x400 + row * 40], 40) && !memcmp(copy + 40, &mem->color_ram[row * 20], 20);
+}
+
+static uint8_t count_bits(uint8_t bits) {
+    uint8_t count = 0;
+    for (; bits; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+}
+
+// When the text screen has moved by whole rows, for example when the KERNAL scrolls, move the
+// pixels that are already drawn instead of redrawing every cell. Returns 1 if the screen was shifted.
+static uint8_t vic_scroll(mem_t *mem) {
+    uint8_t changed = 0;
+    for (uint8_t row = 0; row < 25; row++) {
+        changed += row_dirty[row];
+    }
+    if (changed < 2) {
+        return 0;
+    }
+    uint32_t hash[25];
+    for (uint8_t row = 0; row < 25; row++) {
+        hash[row] = row_dirty[row] ? text_row_hash(mem, row) : row_hash[row];
+    }
+    // find the shift that lines up the most rows that actually changed
+    int8_t best = 0;
+    uint8_t best_matches = 1;
+    for (int8_t shift = -24; shift <= 24; shift++) {
+        uint8_t matches = 0;
+        for (int8_t row = 0; row < 25; row++) {
+            int8_t from = row + shift;
+            if ((from >= 0) && (from < 25) && (hash[row] == row_hash[from]) && (hash[row] != row_hash[row])) {
+                matches++;
             }
-            gfx_SetPixel(x0+x, y0+y);
         }
+        if (matches > best_matches) {
+            best = shift;
+            best_matches = matches;
+        }
+    }
+    if (!best) {
+        return 0;
+    }
+    uint8_t (*buffer)[320] = *gfx_vbuffer;
+    if (best > 0) {
+        memmove(buffer[Y_OFFSET], buffer[Y_OFFSET + best * 8], (25 - best) * 8 * 320);
+        memmove(row_copy[0], row_copy[best], (25 - best) * sizeof(row_copy[0]));
+    } else {
+        memmove(buffer[Y_OFFSET - best * 8], buffer[Y_OFFSET], (25 + best) * 8 * 320);
+        memmove(row_copy[-best], row_copy[0], (25 + best) * sizeof(row_copy[0]));
+    }
+    uint32_t moved[25];
+    for (int8_t row = 0; row < 25; row++) {
+        int8_t from = row + best;
+        uint8_t valid = (from >= 0) && (from < 25);
+        moved[row] = valid ? row_hash[from] : 0;
+        // the hash only picks the shift, the row has to hold exactly what its pixels were drawn from
+        if (valid && (hash[row] == moved[row]) && same_row(mem, row, row_copy[row])) {
+            // the pixels that moved into this row are already right
+            for (uint8_t i = 0; i < 5; i++) {
+                vic_cells_saved += count_bits(dirty[row][i]);
+            }
+            memset(dirty[row], 0, sizeof(dirty[row]));
+            row_dirty[row] = 0;
+        } else {
+            memset(dirty[row], 0xFF, sizeof(dirty[row]));
+            row_dirty[row] = 1;
+        }
+    }
+    memcpy(row_hash, moved, sizeof(row_hash));
+    sprite_scrolled(best * 8);
+    vic_scrolls++;
+    return 1;
+}
+
+void vic_refresh(mem_t *mem) {
+    if (border_dirty) {
+        gfx_SetColor(mem->vic[0x20] & 0x0F);
+        // the performance overlay lives in the top border while it's shown
+        if (!hud_visible) {
+            gfx_FillRectangle_NoClip(0, 0, 320, Y_OFFSET);
+            gfx_BlitLines(gfx_buffer, 0, Y_OFFSET);
+        }
+        gfx_FillRectangle_NoClip(0, Y_OFFSET + 200, 320, 240 - 200 - Y_OFFSET);
+        gfx_BlitLines(gfx_buffer, Y_OFFSET + 200, 240 - 200 - Y_OFFSET);
+        border_dirty = 0;
     }
-    gfx_BlitRectangle(gfx_buffer, x0, y0, 8, 8);
-}
\ No newline at end of file
+    uint8_t bitmap_mode = mem->vic[0x11] & 0x20;
+    uint8_t scrolled = !bitmap_mode && !all_dirty && vic_scroll(mem);
+    all_dirty = 0;
+    sprite_prepare(mem);
+    uint32_t blit = 0;
+    for (uint8_t row = 0; row < 25; row++) {
+        if (!row_dirty[row]) {
+            continue;
+        }
+        uint16_t pos = row * 40;
+        for (uint8_t col = 0; col < 40; col++, pos++) {
+            if (dirty[row][col >> 3] & (1 << (col & 7))) {
+                counters.cells_redrawn++;
+                if (bitmap_mode) {
+                    vic_bitmap(mem, pos);
+                } else {
+                    vic_text(mem, pos, mem->memorya[0x400 + pos]);
+                }
+            }
+        }
+        memset(dirty[row], 0, sizeof(dirty[row]));
+        row_dirty[row] = 0;
+        if (!bitmap_mode) {
+            save_row(mem, row);
+        }
+        blit |= 1UL << row;
+    }
+    // sprites go into the buffer before anything is blitted, so no row is ever shown without them
+    blit |= sprite_draw(mem);
+    if (scrolled) {
+        gfx_BlitLines(gfx_buffer, Y_OFFSET, 200);
+        return;
+    }
+    for (uint8_t row = 0; row < 25;) {
+        if (!(blit & (1UL << row))) {
+            row++;
+            continue;
+        }
+        uint8_t first = row;
+        while ((row < 25) && (blit & (1UL << row))) {
+            row++;
+        }
+        gfx_BlitLines(gfx_buffer, first * 8 + Y_OFFSET, (row - first) * 8);
+    }
+}
@@ -2,7 +2,21 @@
 #define GRAPHICS_H
 #include <stdint.h>
 #include "memory.h"
+extern const uint16_t Y_OFFSET;
+// text screen scrolls handled by moving pixels, and the cell redraws that saved
+extern uint32_t vic_scrolls;
+extern uint32_t vic_cells_saved;
 void vic_text(mem_t *mem, uint16_t pos, uint8_t val);
+void vic_bitmap(mem_t *mem, uint16_t pos);
+void vic_tables_init();
+void vic_mark(uint16_t pos);
+void vic_mark_all();
+void vic_mark_span(uint16_t first, uint16_t last);
+void vic_mark_border();
+void vic_mark_rect(int16_t x, int16_t y, uint8_t width, uint8_t height);
+uint8_t vic_rect_dirty(int16_t x, int16_t y, uint8_t width, uint8_t height);
+uint8_t vic_foreground(mem_t *mem, uint8_t col, uint8_t y);
+void vic_refresh(mem_t *mem);
 void graphics_init();
 void graphics_close();
-#endif
\ No newline at end of file
+#endif
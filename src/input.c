@@ -2,6 +2,10 @@
 #include <ti/getcsc.h>
 #include "cpu.h"
 #include "memory.h"
+#include "counters.h"
+#include "record.h"
+#include "monitor.h"
+#include "paste.h"
 
 
 /*
@@ -170,25 +174,50 @@ uint8_t ti_key_to_64_key(uint8_t key, uint8_t k_2nd, uint8_t k_alpha) {
 }
 
 uint8_t scankey(cpu_t *cpu) {
-    kb_Scan();
+    uint8_t keys[8];
+    uint8_t quit = record_keys(cpu, keys);
     uint8_t buff = mem_peek(cpu->memory, 0xC6);
     uint8_t pressed_key = 0;
-    uint8_t k_2nd = kb_Data[1] & kb_2nd;
-    uint8_t k_alpha = kb_Data[2] & kb_Alpha;
+    uint8_t k_2nd = keys[1] & kb_2nd;
+    uint8_t k_alpha = keys[2] & kb_Alpha;
     static uint8_t prev_key;
+    static uint8_t prev_hud;
+    // [y=] shows or hides the performance overlay
+    uint8_t k_hud = keys[1] & kb_Yequ;
+    if (k_hud && !prev_hud) {
+        counters_toggle_hud();
+    }
+    prev_hud = k_hud;
+    static uint8_t prev_monitor;
+    // [trace] stops in the monitor
+    uint8_t k_monitor = keys[1] & kb_Trace;
+    if (k_monitor && !prev_monitor) {
+        monitor_pause("pause");
+    }
+    prev_monitor = k_monitor;
+    static uint8_t prev_paste;
+    // [window] types in the C64PASTE AppVar
+    uint8_t k_paste = keys[1] & kb_Window;
+    if (k_paste && !prev_paste) {
+        paste_start();
+    }
+    prev_paste = k_paste;
     for (uint8_t key = 1, group = 7; group; --group) {
         for (uint8_t mask = 1; mask; mask <<= 1, ++key) {
-            if ((kb_Data[group] & mask) && !((group == 1) && (mask == kb_2nd)) && !((group == 2) && (mask == kb_Alpha))) {
+            // [2nd] and [alpha] are modifiers, [y=] to [graph] are emulator controls
+            if ((keys[group] & mask) && !((group == 1) && (mask <= kb_2nd)) && !((group == 2) && (mask == kb_Alpha))) {
                 pressed_key = key;
             }
         }
     }
-    if (pressed_key && (prev_key != pressed_key) && (buff < 10)) {
+    if (paste_active) {
+        paste_fill(cpu->memory);
+    } else if (pressed_key && (prev_key != pressed_key) && (buff < 10)) {
         mem_poke(cpu->memory, 0x0277+buff, ti_key_to_64_key(pressed_key, k_2nd, k_alpha));
         mem_poke(cpu->memory, 0xC6, buff+1);
     }
     prev_key = pressed_key;
-    if (kb_On) {
+    if (quit || kb_On) {
         return 1;
     } else {
         return 0;
@@ -0,0 +1,233 @@
+#include <graphx.h>
+#include <fileioc.h>
+#include <debug.h>
+#include <string.h>
+#include <time.h>
+#include "lockstep.h"
+#include "graphics.h"
+#include "counters.h"
+#include "paste.h"
+#include "budget.h"
+
+#ifdef LOCKSTEP
+
+// Differential checker, built with LOCKSTEP=YES. The emulator runs as usual through step_cpu, with
+// translated ROM blocks, shadowed ROMs and the dirty cell renderer, while a second C64 follows it
+// with nothing but cpu_exec on the ROMs in flash. After every step, one instruction or one translated
+// block, the reference catches up to the same instruction count and the registers are compared.
+// RAM is compared after every frame, and once a second the screen is redrawn from scratch to check
+// the renderer. The reference sees the same input because it takes its IRQs where the emulator did
+// and gets a copy of the keyboard buffer and sprite collisions, which come from outside the CPU. Its
+// memory is quiet, so it never touches the renderer, sprites, counters or SID, and has no page
+// tables, so every access and opcode fetch goes through the plain dispatch. It has no REU.
+
+// reference instructions shown when the two disagree
+#define HISTORY 16
+// frames between renderer checks
+#define RENDER_CHECK 60
+
+typedef struct executed {
+    uint16_t pc;
+    uint8_t op;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t s;
+    uint8_t p;
+} executed_t;
+
+static cpu_t ref;
+static mem_t ref_mem;
+static executed_t history[HISTORY];
+static uint8_t history_pos;
+static clock_t ref_time;
+static clock_t opt_time;
+// C64REFA and C64REFB
+static uint8_t *ref_ram[2];
+
+// makes the reference's RAM right after the emulator's, before budget_pointers
+void lockstep_alloc(void) {
+    if (!budget_appvar("C64REFA", 0x8000, &ref_ram[0])) {
+        return;
+    }
+    if (!budget_appvar("C64REFB", 0x8000, &ref_ram[1])) {
+        ti_Delete("C64REFA");
+        return;
+    }
+    budget_take("C64REFA", 0x8000, 0);
+    budget_take("C64REFB", 0x8000, 0);
+}
+
+static uint8_t reference_init(cpu_t *cpu) {
+    if (!ref_ram[0] || !ref_ram[1]) {
+        return 0;
+    }
+    // the same state, but reading the ROMs where they are and without breakpoints
+    ref_mem = *cpu->memory;
+    ref_mem.memorya = ref_ram[0];
+    ref_mem.memoryb = ref_ram[1];
+    memcpy(ref_mem.memorya, cpu->memory->memorya, 0x8000);
+    memcpy(ref_mem.memoryb, cpu->memory->memoryb, 0x8000);
+    memset(ref_mem.watch_pages, 0, sizeof(ref_mem.watch_pages));
+    ref_mem.shadow.count = 0;
+    // its writes would mark cells the emulator's own writes should have marked, and hide a missed one
+    ref_mem.quiet = 1;
+    // there's no room for a second REU, and sharing the emulator's would let one C64 change the other
+    memset(&ref_mem.reu, 0, sizeof(ref_mem.reu));
+    mem_init(&ref_mem);
+    ref = *cpu;
+    ref.memory = &ref_mem;
+    ref.aot = 0;
+    ref.trace = 0;
+    ref_mem.cycles = &ref.cycles;
+    return 1;
+}
+
+static void show_history(void) {
+    dbg_printf("last %u reference instructions:\n", HISTORY);
+    for (uint8_t i = 0; i < HISTORY; i++) {
+        const executed_t *e = &history[(history_pos + i) % HISTORY];
+        dbg_printf("  %04X %02X  A=%02X X=%02X Y=%02X S=%02X P=%02X\n", e->pc, e->op, e->a, e->x, e->y, e->s, e->p);
+    }
+}
+
+static uint8_t compare_registers(cpu_t *cpu) {
+    if ((cpu->a == ref.a) && (cpu->x == ref.x) && (cpu->y == ref.y) && (cpu->s == ref.s) &&
+        (cpu->p == ref.p) && (cpu->pc == ref.pc) && (cpu->cycles == ref.cycles)) {
+        return 1;
+    }
+    dbg_printf("registers differ after %lu instructions\n", (unsigned long) cpu->instructions);
+    dbg_printf("  reference PC=%04X A=%02X X=%02X Y=%02X S=%02X P=%02X cycles=%lu\n",
+                ref.pc, ref.a, ref.x, ref.y, ref.s, ref.p, (unsigned long) ref.cycles);
+    dbg_printf("  emulator  PC=%04X A=%02X X=%02X Y=%02X S=%02X P=%02X cycles=%lu\n",
+                cpu->pc, cpu->a, cpu->x, cpu->y, cpu->s, cpu->p, (unsigned long) cpu->cycles);
+    return 0;
+}
+
+static uint32_t checksum(const uint8_t *data, uint16_t size, uint32_t sum) {
+    for (uint16_t i = 0; i < size; i++) {
+        sum = ((sum << 5) | (sum >> 27)) + data[i];
+    }
+    return sum;
+}
+
+static uint32_t ram_checksum(mem_t *mem) {
+    uint32_t sum = checksum(mem->memorya, 0x8000, 0);
+    sum = checksum(mem->memoryb, 0x8000, sum);
+    return checksum(mem->color_ram, sizeof(mem->color_ram), sum);
+}
+
+static uint8_t compare_ram(cpu_t *cpu) {
+    mem_t *mem = cpu->memory;
+    if (ram_checksum(mem) == ram_checksum(&ref_mem)) {
+        return 1;
+    }
+    dbg_printf("RAM differs after frame %lu\n", (unsigned long) counters.frames);
+    for (uint32_t address = 0; address < 0x10000; address++) {
+        const uint8_t *a = address < 0x8000 ? &mem->memorya[address] : &mem->memoryb[address - 0x8000];
+        const uint8_t *b = address < 0x8000 ? &ref_mem.memorya[address] : &ref_mem.memoryb[address - 0x8000];
+        if (*a != *b) {
+            dbg_printf("  first at %04lX: reference %02X, emulator %02X\n", (unsigned long) address, *b, *a);
+            return 0;
+        }
+    }
+    dbg_printf("  in colour RAM\n");
+    return 0;
+}
+
+static uint32_t screen_checksum(void) {
+    uint32_t sum = 0;
+    for (uint8_t y = 0; y < 200; y++) {
+        sum = checksum((*gfx_vbuffer)[y + Y_OFFSET], 320, sum);
+    }
+    return sum;
+}
+
+// what the dirty cells drew against a full redraw
+static uint8_t compare_screen(cpu_t *cpu) {
+    uint32_t drawn = screen_checksum();
+    vic_mark_all();
+    vic_refresh(cpu->memory);
+    if (drawn == screen_checksum()) {
+        return 1;
+    }
+    dbg_printf("screen differs from a full redraw after frame %lu\n", (unsigned long) counters.frames);
+    return 0;
+}
+
+static void report(cpu_t *cpu) {
+    dbg_printf("lockstep frames=%lu instructions=%lu reference_ms=%lu emulator_ms=%lu speedup=x%lu.%02lu\n",
+                (unsigned long) counters.frames, (unsigned long) cpu->instructions,
+                (unsigned long) ref_time * 1000 / CLOCKS_PER_SEC, (unsigned long) opt_time * 1000 / CLOCKS_PER_SEC,
+                (unsigned long) ref_time / (opt_time ? opt_time : 1),
+                (unsigned long) (ref_time * 100 / (opt_time ? opt_time : 1)) % 100);
+}
+
+// runs the emulator until it quits or the two disagree
+void lockstep_run(cpu_t *cpu) {
+    if (!reference_init(cpu)) {
+        dbg_printf("no room for the reference RAM\n");
+        return;
+    }
+    for (;;) {
+        uint32_t frames = counters.frames;
+        uint8_t pasting = PASTE_WARP && paste_active;
+        clock_t side_work = counters.render_time + counters.input_time;
+        clock_t start = clock();
+        uint8_t quit = step_cpu(cpu);
+        // drawing and scanning the keypad aren't part of what's being compared
+        opt_time += clock() - start - (counters.render_time + counters.input_time - side_work);
+        start = clock();
+        uint8_t ok = 1;
+        while (ok && (ref.instructions < cpu->instructions)) {
+            executed_t *e = &history[history_pos];
+            history_pos = (history_pos + 1) % HISTORY;
+            e->pc = ref.pc;
+            e->op = mem_peek(&ref_mem, ref.pc);
+            e->a = ref.a;
+            e->x = ref.x;
+            e->y = ref.y;
+            e->s = ref.s;
+            e->p = ref.p;
+            ok = !cpu_exec(&ref);
+        }
+        if (counters.frames != frames) {
+            ref_mem.vic[0x1E] = cpu->memory->vic[0x1E];
+            ref_mem.vic[0x1F] = cpu->memory->vic[0x1F];
+            if (cpu_irq_enter(&ref)) {
+                ref_mem.memorya[0xC6] = cpu->memory->memorya[0xC6];
+                memcpy(&ref_mem.memorya[0x0277], &cpu->memory->memorya[0x0277], 10);
+            }
+        } else if (pasting) {
+            // step_cpu tops the keyboard buffer up between IRQs while pasting
+            ref_mem.memorya[0xC6] = cpu->memory->memorya[0xC6];
+            memcpy(&ref_mem.memorya[0x0277], &cpu->memory->memorya[0x0277], 10);
+        }
+        ref_time += clock() - start;
+        if (!ok) {
+            dbg_printf("the reference stopped on opcode %02X at %04X\n", ref.ir, ref.pc - 1);
+        }
+        if (!ok || !compare_registers(cpu)) {
+            show_history();
+            break;
+        }
+        if (counters.frames != frames) {
+            if (!compare_ram(cpu)) {
+                show_history();
+                break;
+            }
+            if (counters.frames % RENDER_CHECK == 0) {
+                if (!(PASTE_WARP && paste_active) && !compare_screen(cpu)) {
+                    break;
+                }
+                report(cpu);
+            }
+        }
+        if (quit) {
+            break;
+        }
+    }
+    report(cpu);
+}
+
+#endif
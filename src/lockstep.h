@@ -0,0 +1,7 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+#include <stdint.h>
+#include "cpu.h"
+void lockstep_alloc(void);
+void lockstep_run(cpu_t *cpu);
+#endif
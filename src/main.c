@@ -10,6 +10,22 @@
 
 #include "cpu.h"
 #include "graphics.h"
+#include "record.h"
+#include "monitor.h"
+#include "budget.h"
+#include "reu.h"
+#ifdef CAPTURE
+#include "capture.h"
+#endif
+#ifdef AUDIO
+#include "sid.h"
+#endif
+#ifdef LOCKSTEP
+#include "lockstep.h"
+#endif
+#ifdef SELFTEST
+#include "selftest.h"
+#endif
 
 /* Main function, called first */
 int main(void)
@@ -21,15 +37,64 @@ int main(void)
     uint8_t basic = ti_Open("C64BASIC", "r");
     uint8_t charset = ti_Open("C64CHAR", "r");
 
-    cpu_t *cpu = init_cpu(kernal, basic, charset);
+    // every AppVar is made before any data pointer is taken, see budget.c
+    cpu_t *cpu = alloc_cpu();
+    if (!cpu) {
+        os_PutStrFull("Not enough free RAM, the C64 needs 64K");
+        while (!os_GetCSC());
+        return 1;
+    }
+#ifdef LOCKSTEP
+    lockstep_alloc();
+#endif
+#ifndef SELFTEST
+    record_alloc();
+#endif
+#ifdef CAPTURE
+    capture_alloc();
+#endif
+#ifdef AUDIO
+    sid_alloc();
+#endif
+#if REU_BANKS && !defined(SELFTEST)
+    // the REU gets what's left
+    reu_alloc(cpu->memory);
+#endif
+    budget_pointers();
+    init_cpu(cpu, kernal, basic, charset);
+    budget_report();
+#ifdef SELFTEST
+    return selftest_run(cpu);
+#endif
 
+    monitor_init(cpu);
+    record_start(cpu);
+#ifdef CAPTURE
+    capture_init();
+#endif
+#ifdef AUDIO
+    sid_init(cpu->cycles);
+#endif
     cpu_start(cpu);
     graphics_init();
+#ifdef LOCKSTEP
+    lockstep_run(cpu);
+#else
     do {} while (!step_cpu(cpu));
+#endif
     dump_cpu(cpu);
     ti_Close(kernal);
     ti_Close(basic);
     graphics_close();
+    // the recording and capture AppVars are cut down to what was written, which can move the C64's RAM,
+    // so this comes after everything that reads it
+    record_stop(cpu);
+#ifdef CAPTURE
+    capture_close();
+#endif
+#ifdef AUDIO
+    sid_close();
+#endif
 
     return 0;
 }
@@ -1,36 +1,372 @@
 #include "memory.h"
 #include "graphics.h"
+#include "sprite.h"
+#include "counters.h"
+#include "monitor.h"
+#include "reu.h"
+#include "sid.h"
+#include "budget.h"
 #include <debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ROM pages the KERNAL IRQ handler, screen editor and the BASIC interpreter loop spend
+// most of their time in, hottest first. The character ROM goes in after the first 8.
+static const uint8_t hot_pages[] = {
+    0xFF, 0xEA, 0xEB, 0xE5, 0xE6, 0xE9, 0xE8, 0xE7, // vectors, IRQ, keyboard scan, screen editor
+    0xA7, 0xA4, 0xA9, 0xA8, 0xAD, 0xAE, 0xB7, 0xBC, // interpreter loop, line input, expression eval
+};
+
+void mem_init(mem_t *mem) {
+    for (uint8_t page = 0; page < 0x20; page++) {
+        mem->basic_pages[page] = mem->basic_rom + page * 0x100;
+        mem->kernal_pages[page] = mem->kernal_rom + page * 0x100;
+    }
+    mem->vic_char = mem->char_rom;
+    // power-on VIC state, so the screen looks right before the KERNAL initialises it
+    mem->vic[0x11] = 0x1B;
+    mem->vic[0x16] = 0xC8;
+    mem->vic[0x18] = 0x14;
+    mem->vic[0x20] = 14;
+    mem->vic[0x21] = 6;
+    mem_map_all(mem);
+}
+
+// Point mem_peek and mem_poke straight at a page when a plain read or write is all it takes. Reads
+// of I/O, and writes to I/O, screen RAM, the displayed bitmap, sprite definitions and the REU's $FF00
+// trigger go the slow way, and so does anything the monitor is watching or stopping on. Quiet memory,
+// the lockstep reference's, has no pages here at all, so it checks the emulator's page tables against
+// the plain dispatch instead of sharing them.
+void mem_map_page(mem_t *mem, uint8_t page) {
+    uint8_t *ram = page >= 0x80 ? mem->memoryb + (page - 0x80) * 0x100 : mem->memorya + page * 0x100;
+    const uint8_t *read = ram;
+    uint8_t *write = ram;
+    uint8_t watch = mem->watch_pages[page];
+    if (page >= 0xE0) {
+        read = mem->kernal_pages[page - 0xE0];
+    } else if (page >= 0xD0) {
+        read = write = NULL;
+    } else if ((page >= 0xA0) && (page < 0xC0)) {
+        read = mem->basic_pages[page - 0xA0];
+    }
+    if ((page >= 0x04) && (page <= 0x07)) {
+        write = NULL;
+    }
+    if (mem->sprite_pages[page] || ((page >= mem->bitmap_start >> 8) && (page < (mem->bitmap_end + 0xFF) >> 8))) {
+        write = NULL;
+    }
+#if REU_BANKS
+    if ((page == 0xFF) && mem->reu.bank_count) {
+        write = NULL;
+    }
+#endif
+    if ((watch & (WATCH_READ | WATCH_EXEC)) || monitor_stop || mem->quiet) {
+        read = NULL;
+    }
+    if ((watch & WATCH_WRITE) || mem->quiet) {
+        write = NULL;
+    }
+    mem->read_pages[page] = read;
+    mem->write_pages[page] = write;
+}
+
+void mem_map_all(mem_t *mem) {
+    uint8_t page = 0;
+    do {
+        mem_map_page(mem, page);
+    } while (++page);
+}
+
+static uint8_t **rom_page(mem_t *mem, uint8_t page) {
+    if (page >= 0xE0) {
+        return &mem->kernal_pages[page - 0xE0];
+    }
+    return &mem->basic_pages[page - 0xA0];
+}
+
+static uint8_t *rom_flash(mem_t *mem, uint8_t page) {
+    if (page >= 0xE0) {
+        return mem->kernal_rom + (page - 0xE0) * 0x100;
+    }
+    return mem->basic_rom + (page - 0xA0) * 0x100;
+}
+
+static void shadow_page(mem_t *mem, uint8_t slot, uint8_t page) {
+    shadow_t *shadow = &mem->shadow;
+    if (shadow->page[slot]) {
+        *rom_page(mem, shadow->page[slot]) = rom_flash(mem, shadow->page[slot]);
+    }
+    memcpy(shadow->data[slot], rom_flash(mem, page), 0x100);
+    *rom_page(mem, page) = shadow->data[slot];
+    if (shadow->page[slot]) {
+        mem_map_page(mem, shadow->page[slot]);
+    }
+    mem_map_page(mem, page);
+    shadow->page[slot] = page;
+}
+
+// Called once a frame by step_cpu with the pc the frame's IRQ interrupted, which is sampled before
+// cpu_irq loads the IRQ vector, so it lands wherever the C64 happened to be running. A ROM page seen
+// there without a copy in RAM takes over the slot whose page was seen longest ago.
+void mem_shadow_tick(mem_t *mem, uint16_t pc, uint32_t frame) {
+    shadow_t *shadow = &mem->shadow;
+    uint8_t page = pc >> 8;
+    if (!shadow->count || (page < 0xA0) || ((page >= 0xC0) && (page < 0xE0))) {
+        return;
+    }
+    uint8_t oldest = 0;
+    for (uint8_t i = 0; i < shadow->count; i++) {
+        if (shadow->page[i] == page) {
+            shadow->used[i] = frame;
+            return;
+        }
+        if (shadow->used[i] < shadow->used[oldest]) {
+            oldest = i;
+        }
+    }
+    shadow_page(mem, oldest, page);
+    shadow->used[oldest] = frame;
+}
+
+static clock_t time_fetches(const uint8_t *page) {
+    volatile uint8_t sink = 0;
+    clock_t start = clock();
+    for (uint8_t pass = 0; pass < 64; pass++) {
+        uint8_t i = 0;
+        do {
+            sink += page[i];
+        } while (++i);
+    }
+    return clock() - start;
+}
+
+void mem_shadow_roms(mem_t *mem) {
+    size_t heap = budget_heap();
+    uint8_t *arena = heap >= 0x5000 ? malloc(0x5000) : NULL;
+    if (arena) {
+        memcpy(arena, mem->kernal_rom, 0x2000);
+        memcpy(arena + 0x2000, mem->basic_rom, 0x2000);
+        memcpy(arena + 0x4000, mem->char_rom, 0x1000);
+        for (uint8_t page = 0; page < 0x20; page++) {
+            mem->kernal_pages[page] = arena + page * 0x100;
+            mem->basic_pages[page] = arena + 0x2000 + page * 0x100;
+        }
+        mem->vic_char = arena + 0x4000;
+        mem_map_all(mem);
+        budget_take("ROM shadow", 0x5000, 1);
+        dbg_printf("shadowed KERNAL, BASIC and character ROM (20K)\n");
+    } else {
+        // not enough heap for everything, so split what the budget says is left into single page slots,
+        // plus the character ROM once the 8 hottest pages fit. The slots start with the hottest pages and
+        // mem_shadow_tick swaps them for whatever the C64 turns out to be running
+        shadow_t *shadow = &mem->shadow;
+        size_t chars_size = heap >= 0x800 + 0x1000 ? 0x1000 : 0;
+        size_t slots = (heap - chars_size) >> 8;
+        if (slots > sizeof(shadow->page)) {
+            slots = sizeof(shadow->page);
+        }
+        uint8_t *block = slots ? malloc(slots * 0x100 + chars_size) : NULL;
+        uint8_t *chars = NULL;
+        if (block) {
+            while (shadow->count < slots) {
+                shadow->data[shadow->count] = block + shadow->count * 0x100;
+                shadow->count++;
+            }
+            if (chars_size) {
+                chars = block + slots * 0x100;
+                memcpy(chars, mem->char_rom, 0x1000);
+                mem->vic_char = chars;
+            }
+        }
+        dbg_printf("shadowed pages:");
+        for (uint8_t i = 0; (i < shadow->count) && (i < sizeof(hot_pages)); i++) {
+            shadow_page(mem, i, hot_pages[i]);
+            // ahead of the empty slots, which have never been used
+            shadow->used[i] = 1;
+            dbg_printf(" %02hhX", hot_pages[i]);
+        }
+        uint8_t spare = shadow->count > sizeof(hot_pages) ? shadow->count - sizeof(hot_pages) : 0;
+        dbg_printf(" and %u more as needed%s\n", spare, chars ? ", character ROM" : "");
+        budget_take("ROM shadow", shadow->count * 0x100 + (chars ? 0x1000 : 0), 1);
+    }
+    // how much faster a KERNAL page reads from its shadow than from the ROM AppVar, when it has one
+    if (mem->kernal_pages[0x1F] != mem->kernal_rom + 0x1F00) {
+        clock_t flash = time_fetches(mem->kernal_rom + 0x1F00);
+        clock_t ram = time_fetches(mem->kernal_pages[0x1F]);
+        dbg_printf("fetch speedup x%lu.%02lu (%lu ticks from the AppVar, %lu from RAM)\n",
+                    (unsigned long) flash / (ram ? ram : 1), (unsigned long) (flash * 100 / (ram ? ram : 1)) % 100,
+                    (unsigned long) flash, (unsigned long) ram);
+    }
+}
+uint8_t color_peek(mem_t *mem, uint16_t pos) {
+    uint8_t packed = mem->color_ram[pos >> 1];
+    return (pos & 1) ? (packed >> 4) : (packed & 0x0F);
+}
+
+void io_poke(mem_t *mem, uint16_t address, uint8_t value) {
+    if (address < 0xD400) {
+        uint8_t reg = address & 0x3F;
+        uint8_t old = mem->vic[reg];
+        if ((reg == 0x1E) || (reg == 0x1F)) {
+            // collision registers are read only
+            return;
+        }
+        mem->vic[reg] = value;
+        if (mem->quiet) {
+            return;
+        }
+        if (old != value) {
+            sprite_register(mem, reg, old);
+        }
+        if (reg == 0x20) {
+            if ((old ^ value) & 0x0F) {
+                vic_mark_border();
+            }
+        } else if ((reg == 0x11) || (reg == 0x16) || (reg == 0x18) || ((reg >= 0x21) && (reg <= 0x24))) {
+            // mode, character base or background colour changes affect every cell
+            if (old != value) {
+                vic_mark_all();
+                if (mem->vic[0x11] & 0x20) {
+                    mem->bitmap_start = (mem->vic[0x18] & 0x08) << 10;
+                    mem->bitmap_end = mem->bitmap_start + 8000;
+                } else {
+                    mem->bitmap_start = mem->bitmap_end = 0;
+                }
+                // writes to the bitmap have to reach the renderer, and writes next to it don't
+                for (uint8_t page = 0; page < 0x40; page++) {
+                    mem_map_page(mem, page);
+                }
+            }
+        }
+        return;
+    }
+#if REU_BANKS
+    if (((address & 0xFF00) == 0xDF00) && mem->reu.bank_count) {
+        // the REU registers repeat every 32 bytes
+        reu_poke(mem, address & 0x1F, value);
+        return;
+    }
+#endif
+#ifdef AUDIO
+    if ((address & 0xFC00) == 0xD400) {
+        // the SID registers repeat every 32 bytes
+        if (!mem->quiet) {
+            sid_poke(mem, address & 0x1F, value);
+        }
+        return;
+    }
+#endif
+    if ((address >= 0xD800) && (address < 0xD800 + 1000)) {
+        uint16_t pos = address - 0xD800;
+        uint8_t *packed = &mem->color_ram[pos >> 1];
+        uint8_t old = *packed;
+        if (pos & 1) {
+            *packed = (old & 0x0F) | (value << 4);
+        } else {
+            *packed = (old & 0xF0) | (value & 0x0F);
+        }
+        if ((*packed != old) && !mem->quiet) {
+            counters.screen_writes++;
+            vic_mark(pos);
+        }
+    }
+}
+
 void mem_poke(mem_t *mem, uint16_t address, uint8_t value) {
+    uint8_t *page = mem->write_pages[address >> 8];
+    if (page) {
+        page[address & 0xFF] = value;
+        return;
+    }
+    if (mem->watch_pages[address >> 8] & WATCH_WRITE) {
+        monitor_access(address, WATCH_WRITE);
+    }
     if (address >= 0x8000) {
+        if ((address & 0xF000) == 0xD000) {
+            io_poke(mem, address, value);
+            return;
+        }
+#if REU_BANKS
+        if ((address == 0xFF00) && ((mem->reu.command & 0x90) == 0x80)) {
+            reu_trigger(mem);
+        }
+#endif
         mem->memoryb[address - 0x8000] = value;
     } else {
+        if ((mem->memorya[address] != value) && !mem->quiet) {
+            if ((address <= 0x7e7) && (address >= 0x400)) {
+                counters.screen_writes++;
+                vic_mark(address - 0x400);
+            }
+            if ((address < mem->bitmap_end) && (address >= mem->bitmap_start)) {
+                vic_mark((address - mem->bitmap_start) >> 3);
+            }
+            if (mem->sprite_pages[address >> 8] || ((address >= 0x7F8) && (address <= 0x7FF))) {
+                sprite_poke(mem, address);
+            }
+        }
         mem->memorya[address] = value;
     }
-    if ((address <= 0x7e7) && (address >= 0x400)) {
-        vic_text(mem, address - 0x400, value);
-    }
 }
-uint8_t io(uint16_t address) {
+
+uint8_t io(mem_t *mem, uint16_t address) {
     if (address == 0xD012)
     {
         return 0x00;
     }
+    if (address < 0xD400) {
+        uint8_t reg = address & 0x3F;
+        if (reg >= 0x2F) {
+            return 0xFF;
+        }
+        if ((reg == 0x1E) || (reg == 0x1F)) {
+            // collision latches clear when read
+            uint8_t hits = mem->vic[reg];
+            mem->vic[reg] = 0;
+            return hits;
+        }
+        if (reg >= 0x20) {
+            // colour registers only have four bits
+            return mem->vic[reg] | 0xF0;
+        }
+        return mem->vic[reg];
+    }
+#ifdef AUDIO
+    if ((address & 0xFC00) == 0xD400) {
+        return sid_peek(mem, address & 0x1F);
+    }
+#endif
+    if ((address >= 0xD800) && (address < 0xD800 + 1000)) {
+        return color_peek(mem, address - 0xD800) | 0xF0;
+    }
+#if REU_BANKS
+    if (((address & 0xFF00) == 0xDF00) && mem->reu.bank_count) {
+        return reu_peek(mem, address & 0x1F);
+    }
+#endif
     return 0xFF;
 }
 
 uint8_t mem_peek(mem_t *mem, uint16_t address) {
+    const uint8_t *page = mem->read_pages[address >> 8];
+    if (page) {
+        return page[address & 0xFF];
+    }
+    if (mem->watch_pages[address >> 8] & WATCH_READ) {
+        monitor_access(address, WATCH_READ);
+    }
     if (address >= 0xE000) {
-        return mem->kernal_rom[address - 0xE000];
+        return mem->kernal_pages[(address >> 8) - 0xE0][address & 0xFF];
     }
     if (address >= 0xD000) {
-        return io(address);
+        return io(mem, address);
     }
-    if (address >= 0xBFFF) {
+    if (address >= 0xC000) {
         return mem->memoryb[address - 0x8000];
     }
     if (address >= 0xA000) {
-        return mem->basic_rom[address - 0xA000];
+        return mem->basic_pages[(address >> 8) - 0xA0][address & 0xFF];
     }
     if (address >= 0x8000) {
         return mem->memoryb[address - 0x8000];
@@ -43,17 +379,23 @@ uint16_t mem_peek2(mem_t *mem, uint16_t address) {
     return mem_peek(mem, address) + ((uint16_t) mem_peek(mem, address + 1)) * 256;
 }
 
+// read a word without carrying into the high byte of the address, like the 6502 does for
+// zero page pointers and JMP ($xxFF)
+uint16_t mem_peek2_page(mem_t *mem, uint16_t address) {
+    return mem_peek(mem, address) + ((uint16_t) mem_peek(mem, (address & 0xFF00) | ((address + 1) & 0xFF))) * 256;
+}
+
 uint8_t vic_peek(mem_t *mem, uint16_t address) {
     if (address < 0x1000) {
         return mem->memorya[address];
     } else if (address < 0x2000) {
-        return mem->char_rom[address-0x1000];
+        return mem->vic_char[address-0x1000];
     } else if (address < 0x8000) {
         return mem->memorya[address];
     } else if (address < 0x9000) {
         return mem->memoryb[address-0x8000];
     } else if (address < 0xA000) {
-        return mem->char_rom[address-0x9000];
+        return mem->vic_char[address-0x9000];
     } else {
         return mem->memoryb[address-0x8000];
     }
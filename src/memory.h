@@ -1,15 +1,83 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 #include <stdint.h>
+// set this to 0 to read the ROMs straight out of their (usually archived) AppVars
+#define SHADOW_ROMS 1
+// largest RAM expansion unit to emulate in 32K banks (4 is a 128K 1700), 0 to leave it out
+#define REU_BANKS 4
+// what the monitor watches on a page, see monitor.c
+#define WATCH_EXEC 1
+#define WATCH_READ 2
+#define WATCH_WRITE 4
+// 17xx RAM expansion unit at $DF00
+typedef struct reu {
+    uint8_t status;
+    uint8_t command;
+    uint16_t c64;
+    uint32_t address;
+    uint16_t length;
+    uint8_t irq_mask;
+    uint8_t control;
+    // what the registers were last written with, restored after a transfer with autoload
+    uint16_t c64_start;
+    uint32_t address_start;
+    uint16_t length_start;
+    // expansion memory in AppVars, a power of two of them, none when there wasn't room
+    uint8_t *banks[REU_BANKS];
+    uint8_t bank_count;
+} reu_t;
+// ROM pages copied to RAM one at a time when there's no room to copy all of them
+typedef struct shadow {
+    uint8_t count;
+    // ROM page each slot holds, 0 while it's empty
+    uint8_t page[0x40];
+    uint8_t *data[0x40];
+    // frame the CPU was last seen running in it
+    uint32_t used[0x40];
+} shadow_t;
 typedef struct mem {
     uint8_t *memorya;
     uint8_t *memoryb;
     uint8_t *basic_rom;
     uint8_t *kernal_rom;
     uint8_t *char_rom;
+    // per-page read pointers for $A000-$BFFF and $E000-$FFFF, either into the AppVar or a RAM shadow
+    uint8_t *basic_pages[0x20];
+    uint8_t *kernal_pages[0x20];
+    // character ROM as seen by the VIC, may be a RAM shadow of char_rom
+    uint8_t *vic_char;
+    // VIC-II registers $D000-$D03F, mirrored through $D3FF
+    uint8_t vic[0x40];
+    // colour RAM $D800-$DBE7, two cells per byte with the even cell in the low nibble
+    uint8_t color_ram[500];
+    // bitmap currently displayed by the VIC, empty when not in a bitmap mode
+    uint16_t bitmap_start;
+    uint16_t bitmap_end;
+    // sprites (one bit each) whose 63-byte definition lies in each page of RAM
+    uint8_t sprite_pages[256];
+    // WATCH_* flags of the breakpoints on each page
+    uint8_t watch_pages[256];
+    // where mem_peek and mem_poke find each page, NULL for pages that need more than a plain access,
+    // see mem_map_page. Opcode fetches use read_pages too, so execute breakpoints take pages off it
+    const uint8_t *read_pages[256];
+    uint8_t *write_pages[256];
+    // set for the lockstep reference, whose writes mustn't reach the renderer, sprites, counters or SID,
+    // and which leaves read_pages and write_pages empty so every access takes the plain dispatch
+    uint8_t quiet;
+    reu_t reu;
+    shadow_t shadow;
+    // cycle counter of the CPU, for DMA transfers to steal cycles from
+    uint32_t *cycles;
 } mem_t;
+void mem_init(mem_t *mem);
+void mem_map_page(mem_t *mem, uint8_t page);
+void mem_map_all(mem_t *mem);
+void mem_shadow_roms(mem_t *mem);
+void mem_shadow_tick(mem_t *mem, uint16_t pc, uint32_t frame);
 void mem_poke(mem_t *mem, uint16_t address, uint8_t value);
 uint8_t mem_peek(mem_t *mem, uint16_t address);
 uint16_t mem_peek2(mem_t *mem, uint16_t address);
+uint16_t mem_peek2_page(mem_t *mem, uint16_t address);
+uint8_t color_peek(mem_t *mem, uint16_t pos);
 uint8_t vic_peek(mem_t *mem, uint16_t address);
-#endif
\ No newline at end of file
+#endif
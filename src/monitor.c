@@ -0,0 +1,340 @@
+#include <graphx.h>
+#include <keypadc.h>
+#include <fileioc.h>
+#include <ti/getcsc.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "monitor.h"
+#include "graphics.h"
+#include "counters.h"
+
+// Breakpoints, watchpoints and a small monitor drawn in the top border.
+//
+// Every breakpoint sets its WATCH_* flag on its page in mem->watch_pages, and mem_map_page takes
+// those pages off the direct read and write pointers, so only accesses and opcode fetches on pages
+// with something armed reach the slow paths that call in here. Stopping takes every page off. Breakpoints can be set from the
+// paused monitor, or listed one per line in the C64MON AppVar, which is read at startup:
+//
+//   b E5CD           stop before executing $E5CD
+//   w 0400 a=20      stop after a write to $0400 while A is $20
+//   r DC01 m00C6=00  stop after a read of $DC01 while $00C6 holds $00
+//
+// Conditions can test a, x, y, s, p or a byte of memory.
+
+#define MAX_BREAKPOINTS 8
+
+enum {
+    COND_NONE,
+    COND_A,
+    COND_X,
+    COND_Y,
+    COND_S,
+    COND_P,
+    COND_MEM,
+};
+
+typedef struct breakpoint {
+    uint16_t address;
+    // one of the WATCH_* flags
+    uint8_t kind;
+    uint8_t cond;
+    uint16_t cond_address;
+    uint8_t value;
+} breakpoint_t;
+
+uint8_t monitor_stop;
+uint8_t monitor_active;
+
+static cpu_t *watched;
+static breakpoint_t breakpoints[MAX_BREAKPOINTS];
+static uint8_t count;
+static uint8_t paused;
+static const char *stop_reason;
+// first address of the memory line shown while paused
+static uint16_t view;
+// hex number being typed on the keypad
+static uint16_t number;
+
+static void rebuild_pages(void) {
+    mem_t *mem = watched->memory;
+    memset(mem->watch_pages, 0, sizeof(mem->watch_pages));
+    monitor_active = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        mem->watch_pages[breakpoints[i].address >> 8] |= breakpoints[i].kind;
+        if (breakpoints[i].kind == WATCH_EXEC) {
+            monitor_active = 1;
+        }
+    }
+    mem_map_all(mem);
+}
+
+// adds the breakpoint, or removes it if the same one is already set
+static void toggle(uint16_t address, uint8_t kind, uint8_t cond, uint16_t cond_address, uint8_t value) {
+    for (uint8_t i = 0; i < count; i++) {
+        if ((breakpoints[i].address == address) && (breakpoints[i].kind == kind)) {
+            breakpoints[i] = breakpoints[--count];
+            rebuild_pages();
+            return;
+        }
+    }
+    if (count == MAX_BREAKPOINTS) {
+        return;
+    }
+    breakpoint_t *bp = &breakpoints[count++];
+    bp->address = address;
+    bp->kind = kind;
+    bp->cond = cond;
+    bp->cond_address = cond_address;
+    bp->value = value;
+    rebuild_pages();
+}
+
+// reads without the side effects of looking at the collision latches
+static uint8_t peek(uint16_t address) {
+    mem_t *mem = watched->memory;
+    if ((address & 0xFC3E) == 0xD01E) {
+        return mem->vic[address & 0x3F];
+    }
+    return mem_peek(mem, address);
+}
+
+static uint8_t holds(const breakpoint_t *bp) {
+    cpu_t *cpu = watched;
+    switch (bp->cond) {
+        case COND_A: return cpu->a == bp->value;
+        case COND_X: return cpu->x == bp->value;
+        case COND_Y: return cpu->y == bp->value;
+        case COND_S: return cpu->s == bp->value;
+        case COND_P: return cpu->p == bp->value;
+        case COND_MEM: return peek(bp->cond_address) == bp->value;
+        default: return 1;
+    }
+}
+
+static const char *parse_hex(const char *text, uint16_t *value) {
+    *value = 0;
+    for (;; text++) {
+        char c = *text;
+        if ((c >= '0') && (c <= '9')) {
+            *value = (*value << 4) | (c - '0');
+        } else if ((c >= 'A') && (c <= 'F')) {
+            *value = (*value << 4) | (c - 'A' + 10);
+        } else if ((c >= 'a') && (c <= 'f')) {
+            *value = (*value << 4) | (c - 'a' + 10);
+        } else {
+            return text;
+        }
+    }
+}
+
+static void parse_line(const char *line) {
+    static const char conds[] = "axysp";
+    uint8_t kind;
+    switch (line[0]) {
+        case 'b': kind = WATCH_EXEC; break;
+        case 'r': kind = WATCH_READ; break;
+        case 'w': kind = WATCH_WRITE; break;
+        default: return;
+    }
+    // the kind is followed by a space and at least one hex digit, anything shorter is skipped
+    if (line[1] != ' ') {
+        return;
+    }
+    uint16_t address;
+    const char *rest = parse_hex(line + 2, &address);
+    if (rest == line + 2) {
+        return;
+    }
+    uint8_t cond = COND_NONE;
+    uint16_t cond_address = 0;
+    uint16_t value = 0;
+    if (*rest == ' ') {
+        rest++;
+        const char *reg = strchr(conds, *rest);
+        if (*rest == 'm') {
+            cond = COND_MEM;
+            rest = parse_hex(rest + 1, &cond_address);
+        } else if (*rest && reg) {
+            cond = COND_A + (reg - conds);
+            rest++;
+        }
+        if (*rest == '=') {
+            parse_hex(rest + 1, &value);
+        } else {
+            cond = COND_NONE;
+        }
+    }
+    toggle(address, kind, cond, cond_address, value);
+}
+
+void monitor_init(cpu_t *cpu) {
+    watched = cpu;
+    uint8_t fp = ti_Open("C64MON", "r");
+    if (!fp) {
+        return;
+    }
+    const char *text = ti_GetDataPtr(fp);
+    uint16_t size = ti_GetSize(fp);
+    char line[32];
+    uint8_t length = 0;
+    for (uint16_t i = 0; i <= size; i++) {
+        if ((i == size) || (text[i] == '\n')) {
+            line[length] = 0;
+            parse_line(line);
+            length = 0;
+        } else if (length < sizeof(line) - 1) {
+            line[length++] = text[i];
+        }
+    }
+    ti_Close(fp);
+    dbg_printf("%u breakpoints from C64MON\n", count);
+}
+
+// called by mem_peek and mem_poke for pages with a read or write watchpoint
+void monitor_access(uint16_t address, uint8_t kind) {
+    if (paused) {
+        return;
+    }
+    // conditions on memory read it too
+    paused = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        if ((breakpoints[i].address == address) && (breakpoints[i].kind == kind) && holds(&breakpoints[i])) {
+            view = address & 0xFFF8;
+            monitor_pause(kind == WATCH_READ ? "read" : "write");
+            break;
+        }
+    }
+    paused = 0;
+}
+
+// stop before the next instruction
+void monitor_pause(const char *reason) {
+    stop_reason = reason;
+    monitor_stop = 1;
+    // so the next opcode fetch, wherever it is, goes through monitor_check
+    if (watched) {
+        mem_map_all(watched->memory);
+    }
+}
+
+static void draw(cpu_t *cpu) {
+    char line[48];
+    static const char flags[] = "NV-BDIZC";
+    char p[9];
+    for (uint8_t i = 0; i < 8; i++) {
+        p[i] = (cpu->p & (0x80 >> i)) ? flags[i] : flags[i] | 0x20;
+    }
+    p[8] = 0;
+    gfx_SetColor(0);
+    gfx_FillRectangle_NoClip(0, 0, 320, Y_OFFSET);
+    gfx_SetTextFGColor(1);
+    gfx_SetTextBGColor(0);
+    sprintf(line, "%04X A=%02X X=%02X Y=%02X S=%02X %s %s", cpu->pc, cpu->a, cpu->x, cpu->y, cpu->s, p, stop_reason);
+    gfx_PrintStringXY(line, 2, 1);
+    char *out = line + sprintf(line, "%04X:", view);
+    for (uint8_t i = 0; i < 8; i++) {
+        out += sprintf(out, " %02X", peek(view + i));
+    }
+    sprintf(out, "  #%04X", number);
+    gfx_PrintStringXY(line, 2, 11);
+    gfx_BlitLines(gfx_buffer, 0, Y_OFFSET);
+}
+
+static int8_t hex_digit(uint8_t key) {
+    static const uint8_t digits[16] = {
+        sk_0, sk_1, sk_2, sk_3, sk_4, sk_5, sk_6, sk_7, sk_8, sk_9,
+        // A to F are the keys that type those letters on the C64
+        sk_Math, sk_Apps, sk_Prgm, sk_Recip, sk_Sin, sk_Cos,
+    };
+    for (uint8_t i = 0; i < 16; i++) {
+        if (digits[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The monitor. [trace] steps one instruction, [graph] continues, [clear] removes every breakpoint and
+// continues, [on] quits. Typing hex digits builds a number: [enter] shows memory there, [sto] toggles
+// an execute breakpoint, [(] a read watchpoint and [,] a write watchpoint on it. The arrows move the
+// memory view by 8 bytes or a page.
+static uint8_t run_monitor(cpu_t *cpu) {
+    clock_t start = clock();
+    uint8_t quit = 0;
+    paused = 1;
+    while (os_GetCSC());
+    for (;;) {
+        draw(cpu);
+        uint8_t key;
+        while (!(key = os_GetCSC())) {
+            if (kb_On) {
+                quit = 1;
+                break;
+            }
+        }
+        if (quit) {
+            break;
+        }
+        int8_t digit = hex_digit(key);
+        if (digit >= 0) {
+            number = (number << 4) | digit;
+            continue;
+        }
+        if (key == sk_Trace) {
+            monitor_pause("step");
+            break;
+        }
+        if (key == sk_Graph) {
+            break;
+        }
+        if (key == sk_Clear) {
+            count = 0;
+            rebuild_pages();
+            break;
+        }
+        switch (key) {
+            case sk_Enter: view = number; break;
+            case sk_Store: toggle(number, WATCH_EXEC, COND_NONE, 0, 0); break;
+            case sk_LParen: toggle(number, WATCH_READ, COND_NONE, 0, 0); break;
+            case sk_Comma: toggle(number, WATCH_WRITE, COND_NONE, 0, 0); break;
+            case sk_Up: view -= 8; break;
+            case sk_Down: view += 8; break;
+            case sk_Left: view -= 0x100; break;
+            case sk_Right: view += 0x100; break;
+        }
+    }
+    paused = 0;
+    // don't make up for the pause with a burst of IRQs
+    cpu->starttime += clock() - start;
+    if (hud_visible) {
+        counters_draw_hud();
+    } else {
+        vic_mark_border();
+    }
+    return quit;
+}
+
+// called by cpu_exec for an opcode fetch from a page that isn't mapped directly, which includes
+// pages with an execute breakpoint and every page after a stop was requested. Returns 1 to quit
+uint8_t monitor_check(cpu_t *cpu) {
+    if ((cpu != watched) || (!monitor_stop && !(cpu->memory->watch_pages[cpu->pc >> 8] & WATCH_EXEC))) {
+        return 0;
+    }
+    if (!monitor_stop) {
+        uint8_t i;
+        for (i = 0; i < count; i++) {
+            if ((breakpoints[i].kind == WATCH_EXEC) && (breakpoints[i].address == cpu->pc) && holds(&breakpoints[i])) {
+                break;
+            }
+        }
+        if (i == count) {
+            return 0;
+        }
+        stop_reason = "break";
+    }
+    monitor_stop = 0;
+    mem_map_all(cpu->memory);
+    return run_monitor(cpu);
+}
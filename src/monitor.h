@@ -0,0 +1,13 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+#include <stdint.h>
+#include "cpu.h"
+// set to stop before the next instruction
+extern uint8_t monitor_stop;
+// set while execute breakpoints are armed or single stepping, which needs every instruction interpreted
+extern uint8_t monitor_active;
+void monitor_init(cpu_t *cpu);
+void monitor_access(uint16_t address, uint8_t kind);
+void monitor_pause(const char *reason);
+uint8_t monitor_check(cpu_t *cpu);
+#endif
@@ -0,0 +1,81 @@
+#include <fileioc.h>
+#include <debug.h>
+#include <stdio.h>
+#include <time.h>
+#include "paste.h"
+
+// Types the text in the C64PASTE AppVar into the C64 by keeping the KERNAL keyboard buffer at $0277
+// full, so a BASIC listing goes in as fast as the screen editor can take it.
+
+uint8_t paste_active;
+
+static uint8_t fp;
+static uint24_t pasted;
+static clock_t started;
+
+void paste_start(void) {
+    if (paste_active) {
+        return;
+    }
+    fp = ti_Open("C64PASTE", "r");
+    if (!fp) {
+        dbg_printf("nothing to paste, C64PASTE not found\n");
+        return;
+    }
+    pasted = 0;
+    started = clock();
+    paste_active = 1;
+}
+
+// ASCII to PETSCII, 0 for characters the C64 can't type
+static uint8_t petscii(int c) {
+    if (c == '\n') {
+        return 13;
+    }
+    if (c == '\t') {
+        return ' ';
+    }
+    if ((c >= 'a') && (c <= 'z')) {
+        // unshifted letters, which are capitals in the default character set
+        return c - 'a' + 'A';
+    }
+    if ((c >= ' ') && (c <= ']')) {
+        return c;
+    }
+    if (c == '^') {
+        // up arrow
+        return 0x5E;
+    }
+    if (c == '_') {
+        // left arrow
+        return 0x5F;
+    }
+    return 0;
+}
+
+// called on every IRQ while pasting and whenever the buffer runs empty, fills the 10 character keyboard
+// buffer back up
+void paste_fill(mem_t *mem) {
+    uint8_t buff = mem_peek(mem, 0xC6);
+    while (fp && (buff < 10)) {
+        int c = ti_GetC(fp);
+        if (c == EOF) {
+            ti_Close(fp);
+            fp = 0;
+            break;
+        }
+        uint8_t key = petscii(c);
+        if (key) {
+            mem_poke(mem, 0x0277 + buff++, key);
+            pasted++;
+        }
+    }
+    mem_poke(mem, 0xC6, buff);
+    if (!fp && !buff) {
+        clock_t ticks = clock() - started;
+        dbg_printf("pasted %lu characters in %lu ms, %lu per second\n", (unsigned long) pasted,
+                    (unsigned long) ((uint64_t) ticks * 1000 / CLOCKS_PER_SEC),
+                    (unsigned long) (ticks ? (uint64_t) pasted * CLOCKS_PER_SEC / ticks : 0));
+        paste_active = 0;
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef PASTE_H
+#define PASTE_H
+#include <stdint.h>
+#include "memory.h"
+// set to 0 to keep drawing the screen while pasting, which is slower
+#define PASTE_WARP 1
+// set from the start of a paste until the C64 has taken every character
+extern uint8_t paste_active;
+void paste_start(void);
+void paste_fill(mem_t *mem);
+#endif
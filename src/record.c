@@ -0,0 +1,158 @@
+#include <keypadc.h>
+#include <fileioc.h>
+#include <ti/screen.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "record.h"
+#include "counters.h"
+#include "budget.h"
+
+// Keypad recording and replay. While either is active the IRQ is paced by emulated cycles instead
+// of the wall clock, so the same keys land on the same instruction and every replay of a recording
+// ends with the same RAM and instruction count. A recording goes straight into a C64REC made at its
+// full size at startup, since growing an AppVar while the emulator runs would move the C64's RAM, and
+// it's cut down to what was recorded at the end.
+
+// room for about a thousand keypad changes
+#define RECORD_SIZE 0x4000
+
+uint8_t record_mode;
+
+// C64REC, and how much of it is used
+static uint8_t *data;
+static uint16_t size;
+static uint16_t length;
+static uint32_t frame;
+static uint8_t last_keys[7];
+static const record_event_t *events;
+static const record_event_t *events_end;
+static record_header_t header;
+static clock_t started;
+
+// held while the program starts: [zoom] records into C64REC, [graph] replays it. Makes C64REC for a
+// recording, so this runs before budget_pointers
+void record_alloc(void) {
+    kb_Scan();
+    if (kb_Data[1] & kb_Zoom) {
+        size = budget_free() < RECORD_SIZE ? budget_free() : RECORD_SIZE;
+        if ((size < sizeof(header)) || !budget_appvar("C64REC", size, &data)) {
+            dbg_printf("no room for C64REC, not recording\n");
+            return;
+        }
+        budget_take("C64REC", size, 0);
+        record_mode = RECORD_ON;
+    } else if (kb_Data[1] & kb_Graph) {
+        uint8_t fp = ti_Open("C64REC", "r");
+        if (!fp) {
+            return;
+        }
+        size = ti_GetSize(fp);
+        ti_Close(fp);
+        if ((size < sizeof(header)) || !budget_appvar("C64REC", 0, &data)) {
+            return;
+        }
+        record_mode = RECORD_REPLAY;
+    }
+}
+
+void record_start(cpu_t *cpu) {
+    if (record_mode == RECORD_ON) {
+        memcpy(data, &header, sizeof(header));
+        length = sizeof(header);
+    } else if (record_mode == RECORD_REPLAY) {
+        memcpy(&header, data, sizeof(header));
+        events = (const record_event_t *) (data + sizeof(header));
+        events_end = events + (size - sizeof(header)) / sizeof(record_event_t);
+    } else {
+        return;
+    }
+    // start from the same power-on state every time
+    memset(cpu->memory->memorya, 0, 0x8000);
+    memset(cpu->memory->memoryb, 0, 0x8000);
+    cpu->cycles = 0;
+    cpu->instructions = 0;
+    cpu->next_irq = 0;
+    started = clock();
+    dbg_printf("%s C64REC\n", record_mode == RECORD_ON ? "recording" : "replaying");
+}
+
+// the keypad state for this scan, returns 1 when a replay is over
+uint8_t record_keys(cpu_t *cpu, uint8_t *keys) {
+    if (record_mode != RECORD_REPLAY) {
+        clock_t start = clock();
+        kb_Scan();
+        counters.input_time += clock() - start;
+        for (uint8_t group = 1; group < 8; group++) {
+            keys[group] = kb_Data[group];
+        }
+        if ((record_mode == RECORD_ON) && memcmp(&keys[1], last_keys, sizeof(last_keys))) {
+            record_event_t event;
+            event.frame = frame;
+            event.cycles = cpu->cycles;
+            memcpy(event.keys, &keys[1], sizeof(event.keys));
+            // once the AppVar is full the rest of the session just isn't recorded
+            if (length + sizeof(event) <= size) {
+                memcpy(data + length, &event, sizeof(event));
+                length += sizeof(event);
+                memcpy(last_keys, &keys[1], sizeof(last_keys));
+            }
+        }
+        frame++;
+        return 0;
+    }
+    while ((events < events_end) && (events->frame <= frame)) {
+        if (events->cycles && (events->cycles != cpu->cycles)) {
+            dbg_printf("replay out of step at frame %lu: cycle %lu, recorded %lu\n",
+                        (unsigned long) frame, (unsigned long) cpu->cycles, (unsigned long) events->cycles);
+        }
+        memcpy(last_keys, events->keys, sizeof(last_keys));
+        events++;
+    }
+    memcpy(&keys[1], last_keys, sizeof(last_keys));
+    // stop on the scan the recording was stopped on, after its keys are handled like they were then
+    return ++frame >= header.frames;
+}
+
+static uint32_t ram_sum(mem_t *mem) {
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < 0x8000; i++) {
+        sum = ((sum << 5) | (sum >> 27)) + mem->memorya[i];
+    }
+    for (uint16_t i = 0; i < 0x8000; i++) {
+        sum = ((sum << 5) | (sum >> 27)) + mem->memoryb[i];
+    }
+    return sum;
+}
+
+// finish the recording, or report how the replay went. Called after the screen is handed back, and
+// before anything cuts its AppVar down and moves the C64's RAM
+void record_stop(cpu_t *cpu) {
+    char line[64];
+    if (record_mode == RECORD_ON) {
+        header.frames = frame;
+        header.cycles = cpu->cycles;
+        memcpy(data, &header, sizeof(header));
+        budget_trim("C64REC", length);
+        sprintf(line, "recorded %lu frames", (unsigned long) frame);
+        os_PutStrFull(line);
+        os_NewLine();
+        return;
+    }
+    if (record_mode != RECORD_REPLAY) {
+        return;
+    }
+    clock_t ticks = clock() - started;
+    uint32_t khz = ticks ? (uint64_t) cpu->cycles * CLOCKS_PER_SEC / ticks / 1000 : 0;
+    const char *match = !header.cycles ? "unknown" : (header.cycles == cpu->cycles ? "yes" : "no");
+    dbg_printf("replay frames=%lu instructions=%lu cycles=%lu ram=%08lX ms=%lu khz=%lu match=%s\n",
+                (unsigned long) frame, (unsigned long) cpu->instructions, (unsigned long) cpu->cycles,
+                (unsigned long) ram_sum(cpu->memory), (unsigned long) ((uint64_t) ticks * 1000 / CLOCKS_PER_SEC),
+                (unsigned long) khz, match);
+    sprintf(line, "%lu instr in %lu ms", (unsigned long) cpu->instructions, (unsigned long) ((uint64_t) ticks * 1000 / CLOCKS_PER_SEC));
+    os_PutStrFull(line);
+    os_NewLine();
+    sprintf(line, "%lu.%03lu MHz", (unsigned long) khz / 1000, (unsigned long) khz % 1000);
+    os_PutStrFull(line);
+    os_NewLine();
+}
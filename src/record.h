@@ -0,0 +1,28 @@
+#ifndef RECORD_H
+#define RECORD_H
+#include <stdint.h>
+#include "cpu.h"
+enum {
+    RECORD_OFF,
+    RECORD_ON,
+    RECORD_REPLAY,
+};
+// one change of the keypad, kb_Data[1] to kb_Data[7], stamped with when it was scanned
+typedef struct record_event {
+    uint32_t frame;
+    uint32_t cycles;
+    uint8_t keys[7];
+} record_event_t;
+// start of the C64REC AppVar, followed by the events
+typedef struct record_header {
+    // the recording stops after this many keypad scans
+    uint32_t frames;
+    // emulated cycles at the end, 0 if unknown
+    uint32_t cycles;
+} record_header_t;
+extern uint8_t record_mode;
+void record_alloc(void);
+void record_start(cpu_t *cpu);
+uint8_t record_keys(cpu_t *cpu, uint8_t *keys);
+void record_stop(cpu_t *cpu);
+#endif
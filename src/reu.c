@@ -0,0 +1,298 @@
+#include <fileioc.h>
+#include <debug.h>
+#include <string.h>
+#include "reu.h"
+#include "graphics.h"
+#include "sprite.h"
+#include "counters.h"
+#include "budget.h"
+
+// 17xx RAM expansion unit. Transfers run all at once when they're started, as block copies wherever
+// both sides are plain memory, and the CPU is charged the cycles the DMA would have taken from it.
+
+#if REU_BANKS
+
+static const char *const BANK_NAMES[] = {"C64REU0", "C64REU1", "C64REU2", "C64REU3"};
+
+enum {
+    REU_STASH,
+    REU_FETCH,
+    REU_SWAP,
+    REU_VERIFY,
+};
+
+// Take as many 32K AppVars as the memory budget allows, a power of two of them so addresses can wrap
+// with a mask. Banks left from an earlier run are already paid for. This makes, resizes and deletes
+// AppVars, so it runs before budget_pointers fills in the banks.
+void reu_alloc(mem_t *mem) {
+    reu_t *reu = &mem->reu;
+    uint8_t count = 0;
+    while (count < REU_BANKS) {
+        uint8_t fp = ti_Open(BANK_NAMES[count], "r");
+        uint8_t kept = fp && (ti_GetSize(fp) == 0x8000);
+        if (fp) {
+            ti_Close(fp);
+        }
+        if (!kept && (budget_free() < 0x8000)) {
+            break;
+        }
+        if (!budget_appvar(BANK_NAMES[count], 0x8000, &reu->banks[count])) {
+            break;
+        }
+        count++;
+    }
+    reu->bank_count = count;
+    while (reu->bank_count & (reu->bank_count - 1)) {
+        reu->bank_count--;
+    }
+    // give back what isn't used, including banks from a run with more room
+    for (uint8_t i = reu->bank_count; i < REU_BANKS; i++) {
+        ti_Delete(BANK_NAMES[i]);
+    }
+    if (reu->bank_count) {
+        budget_take("REU", (size_t) reu->bank_count * 0x8000, 0);
+    }
+    dbg_printf("REU with %uK\n", reu->bank_count * 32);
+}
+
+void reu_init(mem_t *mem) {
+    reu_t *reu = &mem->reu;
+    reu->command = 0x10;
+    reu->length = reu->length_start = 0xFFFF;
+    // a write to $FF00 can start a transfer
+    mem_map_page(mem, 0xFF);
+}
+
+static uint32_t size_mask(reu_t *reu) {
+    return (uint32_t) reu->bank_count * 0x8000 - 1;
+}
+
+// Plain memory the C64 side of a transfer can be copied to or from directly, starting at address and
+// stopping at the end of that kind of memory. NULL for I/O, and for ROM when writing.
+static uint8_t *c64_span(mem_t *mem, uint16_t address, uint8_t write, uint16_t *span) {
+    if (address < 0x8000) {
+        *span = 0x8000 - address;
+        return mem->memorya + address;
+    }
+    if ((address < 0xA000) || ((address >= 0xC000) && (address < 0xD000))) {
+        *span = (address < 0xA000 ? 0xA000 : 0xD000) - address;
+        return mem->memoryb + (address - 0x8000);
+    }
+    if (address < 0xC000) {
+        *span = 0xC000 - address;
+    } else if (address < 0xE000) {
+        *span = 0xE000 - address;
+        return NULL;
+    } else {
+        *span = 0x10000 - address;
+    }
+    // writes under ROM go to RAM, reads see the ROM
+    return write ? mem->memoryb + (address - 0x8000) : NULL;
+}
+
+// let the renderer and sprites know about a block written straight into RAM below $8000
+static void ram_written(mem_t *mem, uint16_t address, uint16_t length) {
+    uint16_t end = address + length;
+    if ((address < 0x7E8) && (end > 0x400)) {
+        uint16_t first = address > 0x400 ? address - 0x400 : 0;
+        uint16_t last = end < 0x7E8 ? end - 0x400 : 1000;
+        counters.screen_writes += last - first;
+        vic_mark_span(first, last);
+    }
+    if ((address < mem->bitmap_end) && (end > mem->bitmap_start)) {
+        uint16_t first = address > mem->bitmap_start ? address - mem->bitmap_start : 0;
+        uint16_t last = (end < mem->bitmap_end ? end : mem->bitmap_end) - mem->bitmap_start;
+        vic_mark_span(first >> 3, ((last - 1) >> 3) + 1);
+    }
+    sprite_span(mem, address, end);
+}
+
+// colour RAM in bulk, packing nibbles without going through io_poke for every byte
+static void color_written(mem_t *mem, uint16_t pos, const uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        uint16_t cell = pos + i;
+        uint8_t *packed = &mem->color_ram[cell >> 1];
+        if (cell & 1) {
+            *packed = (*packed & 0x0F) | (data[i] << 4);
+        } else {
+            *packed = (*packed & 0xF0) | (data[i] & 0x0F);
+        }
+    }
+    counters.screen_writes += length;
+    vic_mark_span(pos, pos + length);
+}
+
+// any watchpoints of the given WATCH_* kinds between address and address + length - 1
+static uint8_t watched(mem_t *mem, uint16_t address, uint16_t length, uint8_t kind) {
+    uint8_t last = (address + length - 1) >> 8;
+    for (uint8_t page = address >> 8;; page++) {
+        if (mem->watch_pages[page] & kind) {
+            return 1;
+        }
+        if (page == last) {
+            return 0;
+        }
+    }
+}
+
+static void transfer(mem_t *mem) {
+    reu_t *reu = &mem->reu;
+    uint8_t command = reu->command;
+    // the command is taken, and the next one starts without waiting for $FF00 unless asked
+    reu->command = (command & 0x7F) | 0x10;
+    uint8_t type = command & 0x03;
+    uint8_t fix_c64 = reu->control & 0x80;
+    uint8_t fix_reu = reu->control & 0x40;
+    uint32_t mask = size_mask(reu);
+    uint32_t remaining = reu->length ? reu->length : 0x10000;
+    uint32_t moved = 0;
+    uint16_t c64 = reu->c64;
+    uint32_t address = reu->address & mask;
+    // what the transfer does to C64 memory, for the monitor's watchpoints
+    uint8_t kind = type == REU_FETCH ? WATCH_WRITE : (type == REU_SWAP ? WATCH_READ | WATCH_WRITE : WATCH_READ);
+    while (remaining) {
+        uint16_t span;
+        // swapping under ROM reads the ROM, so only a fetch can write straight into RAM there
+        uint8_t *ram = c64_span(mem, c64, type == REU_FETCH, &span);
+        uint8_t *bank = reu->banks[address >> 15] + (address & 0x7FFF);
+        uint32_t chunk = remaining;
+        if (chunk > span) {
+            chunk = span;
+        }
+        if (chunk > 0x8000 - (address & 0x7FFF)) {
+            chunk = 0x8000 - (address & 0x7FFF);
+        }
+        // a watched page is copied a byte at a time through mem_peek and mem_poke, which check it
+        if (fix_c64 || fix_reu || (ram && watched(mem, c64, chunk, kind))) {
+            chunk = 1;
+            ram = NULL;
+        }
+        uint16_t n = chunk;
+        if (type == REU_STASH) {
+            if (ram) {
+                memcpy(bank, ram, n);
+            } else {
+                for (uint16_t i = 0; i < n; i++) {
+                    bank[i] = mem_peek(mem, c64 + i);
+                }
+            }
+        } else if (type == REU_FETCH) {
+            if (ram) {
+                memcpy(ram, bank, n);
+                if (c64 < 0x8000) {
+                    ram_written(mem, c64, n);
+                }
+            } else if ((c64 >= 0xD800) && (c64 < 0xD800 + 1000) && !fix_c64) {
+                if (n > 0xD800 + 1000 - c64) {
+                    n = 0xD800 + 1000 - c64;
+                }
+                color_written(mem, c64 - 0xD800, bank, n);
+            } else {
+                for (uint16_t i = 0; i < n; i++) {
+                    mem_poke(mem, c64 + i, bank[i]);
+                }
+            }
+        } else if (type == REU_SWAP) {
+            if (ram) {
+                for (uint16_t i = 0; i < n; i++) {
+                    uint8_t byte = ram[i];
+                    ram[i] = bank[i];
+                    bank[i] = byte;
+                }
+                if (c64 < 0x8000) {
+                    ram_written(mem, c64, n);
+                }
+            } else {
+                for (uint16_t i = 0; i < n; i++) {
+                    uint8_t byte = mem_peek(mem, c64 + i);
+                    mem_poke(mem, c64 + i, bank[i]);
+                    bank[i] = byte;
+                }
+            }
+        } else {
+            for (uint16_t i = 0; i < n; i++) {
+                if ((ram ? ram[i] : mem_peek(mem, c64 + i)) != bank[i]) {
+                    // stop after the byte that differs
+                    reu->status |= 0x20;
+                    n = i + 1;
+                    remaining = n;
+                    break;
+                }
+            }
+        }
+        remaining -= n;
+        moved += n;
+        if (!fix_c64) {
+            c64 += n;
+        }
+        if (!fix_reu) {
+            address = (address + n) & mask;
+        }
+    }
+    // the CPU is held off the bus for a cycle per byte, two when swapping
+    *mem->cycles += type == REU_SWAP ? moved * 2 : moved;
+    reu->status |= 0x40;
+    if ((reu->irq_mask & 0x80) && (reu->irq_mask & reu->status & 0x60)) {
+        reu->status |= 0x80;
+    }
+    if (command & 0x20) {
+        reu->c64 = reu->c64_start;
+        reu->address = reu->address_start;
+        reu->length = reu->length_start;
+    } else {
+        reu->c64 = c64;
+        reu->address = (reu->address & ~mask) | address;
+        reu->length = (reu->status & 0x20) ? (uint16_t) (reu->length - moved) : 1;
+    }
+}
+
+uint8_t reu_peek(mem_t *mem, uint8_t reg) {
+    reu_t *reu = &mem->reu;
+    switch (reg) {
+        case 0x00: {
+            // interrupt, end of block and fault clear when read. Bit 4 is set for 256K and larger
+            uint8_t status = reu->status | (reu->bank_count >= 8 ? 0x10 : 0);
+            reu->status &= 0x1F;
+            return status;
+        }
+        case 0x01: return reu->command;
+        case 0x02: return reu->c64 & 0xFF;
+        case 0x03: return reu->c64 >> 8;
+        case 0x04: return reu->address & 0xFF;
+        case 0x05: return (reu->address >> 8) & 0xFF;
+        case 0x06: return (reu->address >> 16) | 0xF8;
+        case 0x07: return reu->length & 0xFF;
+        case 0x08: return reu->length >> 8;
+        case 0x09: return reu->irq_mask | 0x1F;
+        case 0x0A: return reu->control | 0x3F;
+        default: return 0xFF;
+    }
+}
+
+void reu_poke(mem_t *mem, uint8_t reg, uint8_t value) {
+    reu_t *reu = &mem->reu;
+    switch (reg) {
+        case 0x01:
+            reu->command = value;
+            if ((value & 0x90) == 0x90) {
+                transfer(mem);
+            }
+            return;
+        case 0x02: reu->c64 = reu->c64_start = (reu->c64_start & 0xFF00) | value; return;
+        case 0x03: reu->c64 = reu->c64_start = (reu->c64_start & 0x00FF) | (value << 8); return;
+        case 0x04: reu->address = reu->address_start = (reu->address_start & 0x7FF00) | value; return;
+        case 0x05: reu->address = reu->address_start = (reu->address_start & 0x700FF) | ((uint32_t) value << 8); return;
+        case 0x06: reu->address = reu->address_start = (reu->address_start & 0x0FFFF) | ((uint32_t) (value & 0x07) << 16); return;
+        case 0x07: reu->length = reu->length_start = (reu->length_start & 0xFF00) | value; return;
+        case 0x08: reu->length = reu->length_start = (reu->length_start & 0x00FF) | (value << 8); return;
+        case 0x09: reu->irq_mask = value & 0xE0; return;
+        case 0x0A: reu->control = value & 0xC0; return;
+    }
+}
+
+// a write to $FF00 starts a transfer that was set up to wait for it
+void reu_trigger(mem_t *mem) {
+    transfer(mem);
+}
+
+#endif
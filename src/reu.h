@@ -0,0 +1,10 @@
+#ifndef REU_H
+#define REU_H
+#include <stdint.h>
+#include "memory.h"
+void reu_alloc(mem_t *mem);
+void reu_init(mem_t *mem);
+uint8_t reu_peek(mem_t *mem, uint8_t reg);
+void reu_poke(mem_t *mem, uint8_t reg, uint8_t value);
+void reu_trigger(mem_t *mem);
+#endif
@@ -0,0 +1,238 @@
+#include <ti/screen.h>
+#include <ti/getcsc.h>
+#include <fileioc.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "selftest.h"
+
+#ifdef SELFTEST
+
+// Conformance tests and per-opcode timings for the CPU core, built with SELFTEST=YES.
+// Every result is a single "key=value" line on the debug console so a script can diff runs.
+
+typedef struct test {
+    const char *name;
+    // AppVars holding the image, each at most 32K, loaded back to back from load
+    const char *image[2];
+    uint16_t load;
+    uint16_t start;
+    // the test traps here when everything passed, 0 to judge by the error byte instead
+    uint16_t success;
+    uint16_t error;
+} test_t;
+
+// Klaus Dormann's 6502_functional_test and 6502_decimal_test, assembled with their default options
+static const test_t tests[] = {
+    {"functional", {"C64TSTA", "C64TSTB"}, 0x0000, 0x0400, 0x3469, 0},
+    {"decimal",    {"C64TSTD", NULL},      0x0200, 0x0200, 0,      0x000B},
+};
+
+// stops a test that went off the rails
+static const uint32_t MAX_INSTRUCTIONS = 100000000;
+
+#define BENCH_RUNS 1024
+// a timing more than this many quarters of the baseline counts as a regression
+#define BENCH_LIMIT 5
+#define BENCH_SLACK (2 * 1000000000ULL / CLOCKS_PER_SEC / BENCH_RUNS)
+
+static const char *const MODE_NAMES[] = {
+    "imp", "imm", "zp", "zpx", "zpy", "abs", "absx", "absy", "ind", "indx", "indy", "rel",
+};
+
+// addressing mode of each opcode, indexes MODE_NAMES
+static const uint8_t MODES[256] = {
+    0, 9, 0, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 3, 3, 0, 7, 0, 7, 6, 6, 6, 6,
+    5, 9, 0, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 3, 3, 0, 7, 0, 7, 6, 6, 6, 6,
+    0, 9, 0, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 3, 3, 0, 7, 0, 7, 6, 6, 6, 6,
+    0, 9, 0, 9, 2, 2, 2, 2, 0, 1, 0, 1, 8, 5, 5, 5,  11, 10, 0, 10, 3, 3, 3, 3, 0, 7, 0, 7, 6, 6, 6, 6,
+    1, 9, 1, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 4, 4, 0, 7, 0, 7, 6, 6, 7, 7,
+    1, 9, 1, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 4, 4, 0, 7, 0, 7, 6, 6, 7, 7,
+    1, 9, 1, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 3, 3, 0, 7, 0, 7, 6, 6, 6, 6,
+    1, 9, 1, 9, 2, 2, 2, 2, 0, 1, 0, 1, 5, 5, 5, 5,  11, 10, 0, 10, 3, 3, 3, 3, 0, 7, 0, 7, 6, 6, 6, 6,
+};
+
+static void report(const char *line) {
+    dbg_printf("%s\n", line);
+    os_PutStrFull(line);
+    os_NewLine();
+}
+
+// The test images expect 64K of plain RAM. The self test build has no ROMs, so their pages are
+// pointed at the RAM under them, and the images never touch the I/O area at $D000
+static void flat_memory(mem_t *mem) {
+    for (uint8_t page = 0; page < 0x20; page++) {
+        mem->basic_pages[page] = mem->memoryb + 0x2000 + page * 0x100;
+        mem->kernal_pages[page] = mem->memoryb + 0x6000 + page * 0x100;
+    }
+    mem_map_all(mem);
+}
+
+// straight into RAM, since a 64K image also covers the I/O area
+static uint8_t load_image(cpu_t *cpu, const test_t *test) {
+    mem_t *mem = cpu->memory;
+    uint16_t address = test->load;
+    for (uint8_t i = 0; i < 2 && test->image[i]; i++) {
+        uint8_t fp = ti_Open(test->image[i], "r");
+        if (!fp) {
+            return 0;
+        }
+        const uint8_t *data = ti_GetDataPtr(fp);
+        uint16_t size = ti_GetSize(fp);
+        for (uint16_t j = 0; j < size; j++, address++) {
+            if (address >= 0x8000) {
+                mem->memoryb[address - 0x8000] = data[j];
+            } else {
+                mem->memorya[address] = data[j];
+            }
+        }
+        ti_Close(fp);
+    }
+    return 1;
+}
+
+static uint8_t run_test(cpu_t *cpu, const test_t *test) {
+    char line[64];
+    memset(cpu->memory->memorya, 0, 0x8000);
+    memset(cpu->memory->memoryb, 0, 0x8000);
+    if (!load_image(cpu, test)) {
+        sprintf(line, "test=%s result=missing", test->name);
+        report(line);
+        return 1;
+    }
+    cpu->pc = test->start;
+    cpu->s = 0xFF;
+    cpu->p = 0x04;
+    cpu->cycles = 0;
+    uint32_t count = 0;
+    uint8_t jammed = 0;
+    uint16_t last;
+    clock_t start = clock();
+    do {
+        last = cpu->pc;
+        jammed = step_cpu(cpu);
+        count++;
+        // both tests end in a jump or branch to itself, whether they passed or failed
+    } while (!jammed && cpu->pc != last && count < MAX_INSTRUCTIONS);
+    clock_t ticks = clock() - start;
+    uint8_t passed;
+    if (test->success) {
+        passed = (cpu->pc == test->success);
+    } else {
+        passed = !jammed && cpu->pc == last && !mem_peek(cpu->memory, test->error);
+    }
+    sprintf(line, "test=%s result=%s pc=%04X", test->name, passed ? "pass" : "fail", cpu->pc);
+    report(line);
+    dbg_printf("test=%s instructions=%lu cycles=%lu ticks=%lu\n", test->name,
+                (unsigned long) count, (unsigned long) cpu->cycles, (unsigned long) ticks);
+    return !passed;
+}
+
+// Time one instruction of every opcode, always run from $0200 with the same registers and operand
+// bytes $80 $30, so absolute modes hit $3080 and the zero page pointer at $80 points to $3000.
+static void run_benchmark(cpu_t *cpu, uint32_t *ns) {
+    mem_t *mem = cpu->memory;
+    memset(mem->memorya, 0, 0x8000);
+    memset(mem->memoryb, 0, 0x8000);
+    mem_poke(mem, 0x0080, 0x00);
+    mem_poke(mem, 0x0081, 0x30);
+    mem_poke(mem, 0x0201, 0x80);
+    mem_poke(mem, 0x0202, 0x30);
+    // BRK and the interrupt vectors send control back to $0200
+    mem_poke(mem, 0xFFFE, 0x00);
+    mem_poke(mem, 0xFFFF, 0x02);
+
+    // time the register setup alone so it can be taken off every opcode
+    clock_t start = clock();
+    for (uint16_t run = 0; run < BENCH_RUNS; run++) {
+        cpu->pc = 0x0200;
+        cpu->s = 0xFD;
+        cpu->a = cpu->x = cpu->y = 0;
+        cpu->p = 0x04;
+    }
+    clock_t overhead = clock() - start;
+
+    uint16_t op = 0;
+    do {
+        ns[op] = 0;
+        mem_poke(mem, 0x0200, op);
+        start = clock();
+        uint16_t run;
+        for (run = 0; run < BENCH_RUNS; run++) {
+            cpu->pc = 0x0200;
+            cpu->s = 0xFD;
+            cpu->a = cpu->x = cpu->y = 0;
+            cpu->p = 0x04;
+            if (cpu_exec(cpu)) {
+                break;
+            }
+        }
+        clock_t ticks = clock() - start;
+        if (run < BENCH_RUNS) {
+            // jams the CPU
+            continue;
+        }
+        ticks = (ticks > overhead) ? ticks - overhead : 0;
+        ns[op] = (uint32_t) ((uint64_t) ticks * 1000000000 / CLOCKS_PER_SEC / BENCH_RUNS);
+        // keep the opcode in the table even if it ran faster than the clock can see
+        if (!ns[op]) {
+            ns[op] = 1;
+        }
+    } while (++op < 256);
+}
+
+static uint8_t compare_benchmark(uint32_t *ns) {
+    char line[64];
+    uint8_t regressions = 0;
+    uint8_t fp = ti_Open("C64BENCH", "r");
+    const uint32_t *baseline = NULL;
+    if (fp && ti_GetSize(fp) == 256 * sizeof(uint32_t)) {
+        baseline = ti_GetDataPtr(fp);
+    }
+    for (uint16_t op = 0; op < 256; op++) {
+        if (!ns[op]) {
+            continue;
+        }
+        // allow a couple of clock ticks on top, so the fastest opcodes don't trip on timer resolution
+        uint8_t slow = baseline && baseline[op] && ns[op] * 4 > baseline[op] * BENCH_LIMIT + BENCH_SLACK * 4;
+        dbg_printf("bench op=%02X mode=%s ns=%lu base=%lu%s\n", op, MODE_NAMES[MODES[op]],
+                    (unsigned long) ns[op], (unsigned long) (baseline ? baseline[op] : 0), slow ? " regression" : "");
+        if (slow) {
+            regressions++;
+        }
+    }
+    if (fp) {
+        ti_Close(fp);
+    }
+    if (!baseline) {
+        // nothing to compare with, which can't count as a pass. Save these timings so the next run has a baseline
+        fp = ti_Open("C64BENCH", "w");
+        if (fp) {
+            ti_Write(ns, sizeof(uint32_t), 256, fp);
+            ti_Close(fp);
+        }
+        report("bench result=nobaseline");
+        return 1;
+    }
+    sprintf(line, "bench result=%s regressions=%u", regressions ? "fail" : "pass", regressions);
+    report(line);
+    return regressions;
+}
+
+uint8_t selftest_run(cpu_t *cpu) {
+    static uint32_t ns[256];
+    char line[64];
+    uint8_t failed = 0;
+    flat_memory(cpu->memory);
+    for (uint8_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        failed += run_test(cpu, &tests[i]);
+    }
+    run_benchmark(cpu, ns);
+    failed += compare_benchmark(ns);
+    sprintf(line, "selftest result=%s failures=%u", failed ? "fail" : "pass", failed);
+    report(line);
+    while (!os_GetCSC());
+    return failed;
+}
+#endif
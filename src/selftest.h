@@ -0,0 +1,6 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+#include <stdint.h>
+#include "cpu.h"
+uint8_t selftest_run(cpu_t *cpu);
+#endif
@@ -0,0 +1,412 @@
+#include <fileioc.h>
+#include <debug.h>
+#include <string.h>
+#include <time.h>
+#include "sid.h"
+#include "budget.h"
+
+#ifdef AUDIO
+
+// SID sound, built with AUDIO=YES. Register writes are logged with the cycle they happened on, and
+// once per frame the sound since the last frame is synthesised in one go, splitting the block
+// wherever a write landed. Each voice is generated a whole block at a time, phase, waveform,
+// envelope and mix in separate loops. The result goes to the C64WAV AppVar as an 8-bit mono WAV,
+// which is made at its full size at startup and written in place, since growing an AppVar while the
+// emulator runs would move the C64's RAM, and cut down to what was written when it quits.
+
+#define SID_CLOCK 985248UL
+#define BLOCK 256
+#define LOG_SIZE 128
+// phase accumulator step per sample for a frequency register of 1, times 256
+#define STEP_Q8 (SID_CLOCK * 256 / SID_RATE)
+#define WAV_HEADER 44
+// the largest an AppVar can be
+#define WAV_SIZE 65505
+
+enum {
+    ENV_ATTACK,
+    ENV_DECAY,
+    ENV_RELEASE,
+};
+
+typedef struct voice {
+    // 24 bit phase
+    uint32_t acc;
+    uint32_t lfsr;
+    // level in 8.16 fixed point
+    uint32_t env;
+    uint8_t state;
+} voice_t;
+
+typedef struct sid_log {
+    uint32_t cycle;
+    uint8_t reg;
+    uint8_t value;
+} sid_log_t;
+
+// attack times in ms, decay and release take three times as long
+static const uint16_t attack_ms[16] = {2, 8, 16, 24, 38, 56, 68, 80, 100, 250, 500, 800, 1000, 3000, 5000, 8000};
+
+static uint8_t regs[0x20];
+static voice_t voices[3];
+static uint32_t attack_step[16];
+static uint32_t decay_step[16];
+static sid_log_t writes[LOG_SIZE];
+static uint8_t logged;
+static uint32_t next_sample;
+static int32_t low, band;
+// voice 3 as the CPU last read it
+static uint8_t osc3, env3;
+
+static uint32_t phase[3][BLOCK];
+static uint16_t wave[BLOCK];
+static uint8_t env[BLOCK];
+static int16_t direct[BLOCK];
+static int16_t filtered[BLOCK];
+static uint8_t out[BLOCK];
+
+// C64WAV, NULL once it's full or when there wasn't room for it
+static uint8_t *wav;
+static uint16_t wav_size;
+static uint32_t written;
+static clock_t spent;
+
+static void put32(uint8_t *dst, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++, value >>= 8) {
+        dst[i] = value;
+    }
+}
+
+static void wav_header(uint8_t *header, uint32_t samples) {
+    static const uint8_t format[16] = {1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 8, 0};
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + samples);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);
+    memcpy(header + 20, format, 16);
+    put32(header + 24, SID_RATE);
+    put32(header + 28, SID_RATE);
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, samples);
+}
+
+static uint32_t sample_at(uint32_t cycle) {
+    return (uint64_t) cycle * SID_RATE / SID_CLOCK;
+}
+
+// makes C64WAV, before budget_pointers
+void sid_alloc(void) {
+    size_t size = budget_free() < WAV_SIZE ? budget_free() : WAV_SIZE;
+    if ((size > WAV_HEADER) && budget_appvar("C64WAV", size, &wav)) {
+        wav_size = size;
+        budget_take("C64WAV", size, 0);
+    } else {
+        dbg_printf("no room for C64WAV, no sound\n");
+    }
+}
+
+void sid_init(uint32_t cycles) {
+    if (!wav) {
+        return;
+    }
+    wav_header(wav, 0);
+    for (uint8_t i = 0; i < 16; i++) {
+        uint32_t samples = (uint32_t) attack_ms[i] * SID_RATE / 1000;
+        attack_step[i] = (255UL << 16) / samples;
+        decay_step[i] = (255UL << 16) / (samples * 3);
+    }
+    for (uint8_t v = 0; v < 3; v++) {
+        voices[v].lfsr = 0x7FFFF8;
+        voices[v].state = ENV_RELEASE;
+    }
+    next_sample = sample_at(cycles);
+}
+
+static void apply(uint8_t reg, uint8_t value) {
+    uint8_t old = regs[reg];
+    regs[reg] = value;
+    if ((reg < 0x15) && (reg % 7 == 4)) {
+        voice_t *voice = &voices[reg / 7];
+        if ((value & 0x01) && !(old & 0x01)) {
+            voice->state = ENV_ATTACK;
+        } else if (!(value & 0x01) && (old & 0x01)) {
+            voice->state = ENV_RELEASE;
+        }
+        if (value & 0x08) {
+            voice->acc = 0;
+        }
+    }
+}
+
+static void envelope(voice_t *voice, const uint8_t *r, uint16_t n) {
+    uint32_t e = voice->env;
+    uint32_t sustain = (uint32_t) ((r[6] >> 4) * 17) << 16;
+    uint32_t attack = attack_step[r[5] >> 4];
+    uint32_t decay = decay_step[r[5] & 0x0F];
+    uint32_t release = decay_step[r[6] & 0x0F];
+    for (uint16_t i = 0; i < n; i++) {
+        if (voice->state == ENV_ATTACK) {
+            e += attack;
+            if (e >= (255UL << 16)) {
+                e = 255UL << 16;
+                voice->state = ENV_DECAY;
+            }
+        } else if (voice->state == ENV_DECAY) {
+            // the level holds at sustain, and doesn't climb back up if sustain is raised
+            if (e > sustain) {
+                e = (e - sustain > decay) ? e - decay : sustain;
+            }
+        } else {
+            e = (e > release) ? e - release : 0;
+        }
+        env[i] = e >> 16;
+    }
+    voice->env = e;
+}
+
+// the phases of all three voices first, since ring modulation and sync look at the previous one
+static void phases(uint16_t n) {
+    uint32_t start[3];
+    uint32_t step[3];
+    for (uint8_t v = 0; v < 3; v++) {
+        const uint8_t *r = regs + v * 7;
+        uint32_t acc = start[v] = voices[v].acc;
+        uint32_t s = step[v] = (r[4] & 0x08) ? 0 : (((uint32_t) (r[0] | (r[1] << 8)) * STEP_Q8) >> 8);
+        uint32_t *p = phase[v];
+        for (uint16_t i = 0; i < n; i++) {
+            acc = (acc + s) & 0xFFFFFF;
+            p[i] = acc;
+        }
+    }
+    for (uint8_t v = 0; v < 3; v++) {
+        uint8_t src = (v + 2) % 3;
+        if (regs[v * 7 + 4] & 0x02) {
+            // hard sync, restart whenever the previous voice's top bit rises
+            uint32_t acc = start[v];
+            uint32_t prev = start[src];
+            const uint32_t *sp = phase[src];
+            uint32_t *p = phase[v];
+            for (uint16_t i = 0; i < n; i++) {
+                acc = (sp[i] & ~prev & 0x800000) ? 0 : (acc + step[v]) & 0xFFFFFF;
+                prev = sp[i];
+                p[i] = acc;
+            }
+        }
+    }
+    for (uint8_t v = 0; v < 3; v++) {
+        voices[v].acc = n ? phase[v][n - 1] : voices[v].acc;
+    }
+}
+
+static uint8_t noise_bits(uint32_t l) {
+    return ((l >> 15) & 0x80) | ((l >> 14) & 0x40) | ((l >> 11) & 0x20) | ((l >> 9) & 0x10) |
+           ((l >> 8) & 0x08) | ((l >> 5) & 0x04) | ((l >> 3) & 0x02) | ((l >> 2) & 0x01);
+}
+
+// the voice's waveforms ANDed together, like selecting several does on a real SID
+static void waveform(uint8_t v, uint32_t before, uint16_t n) {
+    const uint8_t *r = regs + v * 7;
+    const uint32_t *p = phase[v];
+    const uint32_t *sp = phase[(v + 2) % 3];
+    uint8_t control = r[4];
+    for (uint16_t i = 0; i < n; i++) {
+        wave[i] = 0xFFF;
+    }
+    if (control & 0x10) {
+        uint32_t ring = (control & 0x04) ? 0x800000 : 0;
+        for (uint16_t i = 0; i < n; i++) {
+            uint32_t fold = ((p[i] ^ (sp[i] & ring)) & 0x800000) ? ~p[i] : p[i];
+            wave[i] &= (fold >> 11) & 0xFFF;
+        }
+    }
+    if (control & 0x20) {
+        for (uint16_t i = 0; i < n; i++) {
+            wave[i] &= p[i] >> 12;
+        }
+    }
+    if (control & 0x40) {
+        uint16_t width = (r[2] | (r[3] << 8)) & 0xFFF;
+        uint16_t high = (control & 0x08) ? 0xFFF : 0;
+        for (uint16_t i = 0; i < n; i++) {
+            wave[i] &= ((p[i] >> 12) >= width) ? 0xFFF : high;
+        }
+    }
+    if (control & 0x80) {
+        // the shift register is clocked by bit 19 of the phase
+        uint32_t l = voices[v].lfsr;
+        uint32_t prev = before;
+        for (uint16_t i = 0; i < n; i++) {
+            for (uint8_t clocks = ((prev & 0xFFFFF) + ((p[i] - prev) & 0xFFFFFF)) >> 20; clocks; clocks--) {
+                l = ((l << 1) | (((l >> 22) ^ (l >> 17)) & 1)) & 0x7FFFFF;
+            }
+            prev = p[i];
+            wave[i] &= noise_bits(l) << 4;
+        }
+        voices[v].lfsr = l;
+    }
+}
+
+static void synth(uint16_t n) {
+    uint32_t before[3] = {voices[0].acc, voices[1].acc, voices[2].acc};
+    phases(n);
+    memset(direct, 0, n * sizeof(direct[0]));
+    memset(filtered, 0, n * sizeof(filtered[0]));
+    uint8_t route = regs[0x17];
+    uint8_t mode = regs[0x18];
+    for (uint8_t v = 0; v < 3; v++) {
+        envelope(&voices[v], regs + v * 7, n);
+        if (v == 2) {
+            env3 = env[n - 1];
+        }
+        if (!(regs[v * 7 + 4] & 0xF0)) {
+            continue;
+        }
+        waveform(v, before[v], n);
+        if (v == 2) {
+            if ((mode & 0x80) && !(route & 0x04)) {
+                // voice 3 off only mutes it when it doesn't go through the filter
+                continue;
+            }
+        }
+        int16_t *dst = (route & (1 << v)) ? filtered : direct;
+        for (uint16_t i = 0; i < n; i++) {
+            dst[i] += ((int32_t) (wave[i] - 0x800) * env[i]) >> 8;
+        }
+    }
+    // state variable filter, 30 Hz to 12 kHz
+    int32_t f = (30 + (int32_t) ((regs[0x15] & 0x07) | (regs[0x16] << 3)) * 6) * 25736 / SID_RATE;
+    if (f > 3000) {
+        f = 3000;
+    }
+    int32_t q = 5780 - (route >> 4) * 245;
+    uint8_t volume = mode & 0x0F;
+    for (uint16_t i = 0; i < n; i++) {
+        low += (f * band) >> 12;
+        int32_t high = filtered[i] - low - ((q * band) >> 12);
+        band += (f * high) >> 12;
+        if (band > 32767) {
+            band = 32767;
+        } else if (band < -32767) {
+            band = -32767;
+        }
+        if (low > 32767) {
+            low = 32767;
+        } else if (low < -32767) {
+            low = -32767;
+        }
+        int32_t sum = direct[i];
+        if (mode & 0x10) {
+            sum += low;
+        }
+        if (mode & 0x20) {
+            sum += band;
+        }
+        if (mode & 0x40) {
+            sum += high;
+        }
+        sum = (sum * volume) >> 9;
+        out[i] = (sum > 127 ? 127 : sum < -128 ? -128 : sum) + 128;
+    }
+    if (n > wav_size - WAV_HEADER - written) {
+        dbg_printf("C64WAV is full after %lu samples\n", (unsigned long) written);
+        wav = NULL;
+        return;
+    }
+    memcpy(wav + WAV_HEADER + written, out, n);
+    written += n;
+    if (written / SID_RATE != (written - n) / SID_RATE) {
+        dbg_printf("sid %lu ms per emulated second\n", (unsigned long) spent * 1000 / CLOCKS_PER_SEC);
+        spent = 0;
+    }
+}
+
+// synthesise up to the sample for this cycle
+static void render_to(uint32_t sample) {
+    while (wav && (next_sample < sample)) {
+        uint32_t n = sample - next_sample;
+        if (n > BLOCK) {
+            n = BLOCK;
+        }
+        synth(n);
+        next_sample += n;
+    }
+}
+
+// everything up to this cycle, applying the logged writes where they happened
+void sid_frame(uint32_t cycles) {
+    if (!wav) {
+        return;
+    }
+    clock_t start = clock();
+    for (uint8_t i = 0; i < logged; i++) {
+        render_to(sample_at(writes[i].cycle));
+        apply(writes[i].reg, writes[i].value);
+    }
+    logged = 0;
+    render_to(sample_at(cycles));
+    spent += clock() - start;
+}
+
+void sid_poke(mem_t *mem, uint8_t reg, uint8_t value) {
+    if (!wav || (reg > 0x18)) {
+        return;
+    }
+    if (logged == LOG_SIZE) {
+        sid_frame(*mem->cycles);
+    }
+    writes[logged].cycle = *mem->cycles;
+    writes[logged].reg = reg;
+    writes[logged].value = value;
+    logged++;
+}
+
+// Voice 3's waveform at this cycle, which can fall between two samples. The phases are moved on from
+// the last sample without touching the voices, and noise programs reading it for random numbers see
+// the shift register clocked up to now. With no waveform selected the last value holds.
+static uint8_t osc3_at(uint32_t cycles) {
+    if (!wav || !(regs[0x12] & 0xF0)) {
+        return osc3;
+    }
+    uint32_t delta = cycles - (uint32_t) ((uint64_t) next_sample * SID_CLOCK / SID_RATE);
+    for (uint8_t v = 1; v < 3; v++) {
+        const uint8_t *r = regs + v * 7;
+        uint32_t step = (r[4] & 0x08) ? 0 : (uint32_t) (r[0] | (r[1] << 8));
+        phase[v][0] = (voices[v].acc + step * delta) & 0xFFFFFF;
+    }
+    uint32_t lfsr = voices[2].lfsr;
+    waveform(2, voices[2].acc, 1);
+    voices[2].lfsr = lfsr;
+    return wave[0] >> 4;
+}
+
+// the oscillator and envelope of voice 3, the paddles aren't connected. Everything up to this cycle
+// is synthesised first. The lockstep reference reads what the emulator just read, instead of moving
+// the sound on from its own cycle counter
+uint8_t sid_peek(mem_t *mem, uint8_t reg) {
+    if ((reg == 0x1B) || (reg == 0x1C)) {
+        if (wav && !mem->quiet) {
+            sid_frame(*mem->cycles);
+            osc3 = osc3_at(*mem->cycles);
+        }
+        return reg == 0x1B ? osc3 : env3;
+    }
+    return 0xFF;
+}
+
+// called once the emulator has stopped, since cutting C64WAV down can move the C64's RAM
+void sid_close(void) {
+    if (wav_size) {
+        uint8_t header[WAV_HEADER];
+        wav_header(header, written);
+        uint8_t fp = ti_Open("C64WAV", "r+");
+        if (fp) {
+            ti_Write(header, sizeof(header), 1, fp);
+            ti_Close(fp);
+        }
+        budget_trim("C64WAV", WAV_HEADER + written);
+        wav_size = 0;
+        wav = NULL;
+    }
+}
+
+#endif
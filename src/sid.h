@@ -0,0 +1,13 @@
+#ifndef SID_H
+#define SID_H
+#include <stdint.h>
+#include "memory.h"
+// samples per second written to C64WAV
+#define SID_RATE 8000
+void sid_alloc(void);
+void sid_init(uint32_t cycles);
+void sid_poke(mem_t *mem, uint8_t reg, uint8_t value);
+uint8_t sid_peek(mem_t *mem, uint8_t reg);
+void sid_frame(uint32_t cycles);
+void sid_close(void);
+#endif
@@ -0,0 +1,326 @@
+#include "sprite.h"
+#include "graphics.h"
+#include "memory.h"
+#include <graphx.h>
+#include <string.h>
+
+typedef struct sprite {
+    // pixel colours and opaque pixels of each row, already expanded in X. Bit 47 of a mask is the leftmost pixel
+    uint8_t color[21][48];
+    uint64_t mask[21];
+    uint8_t valid;
+    // position and size drawn last frame, in display coordinates
+    uint8_t drawn;
+    int16_t x;
+    int16_t y;
+    uint8_t width;
+    uint8_t height;
+    uint8_t behind;
+    // set when the sprite has to be composited this frame
+    uint8_t redraw;
+} sprite_t;
+
+static sprite_t sprites[8];
+
+static uint16_t sprite_data(mem_t *mem, uint8_t n) {
+    return mem->memorya[0x7F8 + n] * 64;
+}
+
+// only enabled sprites are watched, so writes to pages holding no visible sprite skip sprite_poke
+static void sprite_map(mem_t *mem) {
+    // sprite definitions can only be in the first 16K
+    uint8_t old[0x40];
+    memcpy(old, mem->sprite_pages, sizeof(old));
+    memset(mem->sprite_pages, 0, sizeof(mem->sprite_pages));
+    for (uint8_t n = 0; n < 8; n++) {
+        if (mem->vic[0x15] & (1 << n)) {
+            mem->sprite_pages[sprite_data(mem, n) >> 8] |= 1 << n;
+        }
+    }
+    for (uint8_t page = 0; page < sizeof(old); page++) {
+        if (!old[page] != !mem->sprite_pages[page]) {
+            mem_map_page(mem, page);
+        }
+    }
+}
+
+static void sprite_invalidate(uint8_t bits) {
+    for (uint8_t n = 0; n < 8; n++) {
+        if (bits & (1 << n)) {
+            sprites[n].valid = 0;
+        }
+    }
+}
+
+void sprite_poke(mem_t *mem, uint16_t address) {
+    if ((address >= 0x7F8) && (address <= 0x7FF)) {
+        sprite_invalidate(1 << (address - 0x7F8));
+        sprite_map(mem);
+        return;
+    }
+    uint8_t bits = mem->sprite_pages[address >> 8];
+    for (uint8_t n = 0; n < 8; n++) {
+        if ((bits & (1 << n)) && ((uint16_t)(address - sprite_data(mem, n)) < 63)) {
+            sprites[n].valid = 0;
+        }
+    }
+}
+
+// sprite_poke for a block copied straight into RAM, looking at each page once rather than each byte
+void sprite_span(mem_t *mem, uint16_t address, uint16_t end) {
+    if ((address <= 0x7FF) && (end > 0x7F8)) {
+        uint16_t first = address > 0x7F8 ? address : 0x7F8;
+        uint16_t last = end < 0x800 ? end : 0x800;
+        sprite_invalidate((uint8_t) (((1 << (last - 0x7F8)) - 1) & ~((1 << (first - 0x7F8)) - 1)));
+        sprite_map(mem);
+    }
+    uint8_t bits = 0;
+    for (uint16_t page = address >> 8; page <= (uint16_t) ((end - 1) >> 8); page++) {
+        bits |= mem->sprite_pages[page];
+    }
+    for (uint8_t n = 0; n < 8; n++) {
+        uint16_t data = sprite_data(mem, n);
+        if ((bits & (1 << n)) && (data < end) && (data + 63 > address)) {
+            sprites[n].valid = 0;
+        }
+    }
+}
+
+void sprite_register(mem_t *mem, uint8_t reg, uint8_t old) {
+    uint8_t value = mem->vic[reg];
+    if (reg == 0x15) {
+        // definitions of disabled sprites aren't watched, so rebuild anything that just got enabled
+        sprite_invalidate(value & ~old);
+        sprite_map(mem);
+    } else if ((reg == 0x17) || (reg == 0x1B) || (reg == 0x1C) || (reg == 0x1D)) {
+        sprite_invalidate(old ^ value);
+    } else if ((reg == 0x25) || (reg == 0x26)) {
+        sprite_invalidate(mem->vic[0x1C]);
+    } else if ((reg >= 0x27) && (reg <= 0x2E)) {
+        sprite_invalidate(1 << (reg - 0x27));
+    }
+}
+
+static void sprite_build(mem_t *mem, uint8_t n) {
+    sprite_t *sprite = &sprites[n];
+    uint8_t *regs = mem->vic;
+    uint16_t data = sprite_data(mem, n);
+    uint8_t expand = (regs[0x1D] >> n) & 1;
+    uint8_t colors[4] = {0, regs[0x25] & 0x0F, regs[0x27 + n] & 0x0F, regs[0x26] & 0x0F};
+    memset(sprite->mask, 0, sizeof(sprite->mask));
+    for (uint8_t row = 0; row < 21; row++, data += 3) {
+        uint32_t bits = ((uint32_t) vic_peek(mem, data) << 16) | ((uint16_t) vic_peek(mem, data + 1) << 8) | vic_peek(mem, data + 2);
+        uint8_t *color = sprite->color[row];
+        uint64_t mask = 0;
+        if (regs[0x1C] & (1 << n)) {
+            // multicolour: 12 double-wide pixels, pair 00 is transparent
+            uint8_t size = 2 << expand;
+            for (uint8_t x = 0; x < 12; x++, bits <<= 2) {
+                uint8_t pair = (bits >> 22) & 0x03;
+                memset(color, colors[pair], size);
+                color += size;
+                mask = (mask << size) | (pair ? (1 << size) - 1 : 0);
+            }
+        } else {
+            uint8_t size = 1 << expand;
+            for (uint8_t x = 0; x < 24; x++, bits <<= 1) {
+                uint8_t set = (bits >> 23) & 1;
+                memset(color, colors[2], size);
+                color += size;
+                mask = (mask << size) | (set ? (1 << size) - 1 : 0);
+            }
+        }
+        sprite->mask[row] = mask << (48 - (24 << expand));
+    }
+    sprite->valid = 1;
+}
+
+// erase sprites that moved, changed or were disabled since the last frame and decide which ones to composite
+void sprite_prepare(mem_t *mem) {
+    uint8_t *regs = mem->vic;
+    for (uint8_t n = 0; n < 8; n++) {
+        sprite_t *sprite = &sprites[n];
+        uint8_t enabled = regs[0x15] & (1 << n);
+        int16_t x = regs[n * 2] + ((regs[0x10] & (1 << n)) ? 256 : 0) - 24;
+        int16_t y = regs[n * 2 + 1] - 50;
+        uint8_t changed = !sprite->valid || (x != sprite->x) || (y != sprite->y);
+        if (sprite->drawn && (changed || !enabled)) {
+            vic_mark_rect(sprite->x, sprite->y, sprite->width, sprite->height);
+            sprite->drawn = 0;
+        }
+        sprite->redraw = enabled && changed;
+        if (enabled) {
+            if (!sprite->valid) {
+                sprite_build(mem, n);
+            }
+            sprite->x = x;
+            sprite->y = y;
+            sprite->width = 24 << ((regs[0x1D] >> n) & 1);
+            sprite->height = 21 << ((regs[0x17] >> n) & 1);
+            sprite->behind = (regs[0x1B] >> n) & 1;
+        }
+    }
+    // anything overlapping a cell that is about to be redrawn gets erased with it
+    for (uint8_t n = 0; n < 8; n++) {
+        sprite_t *sprite = &sprites[n];
+        if ((regs[0x15] & (1 << n)) && !sprite->redraw) {
+            sprite->redraw = vic_rect_dirty(sprite->x, sprite->y, sprite->width, sprite->height);
+        }
+    }
+    // and sprites overlapping a redrawn sprite have to be drawn again to keep their priority
+    for (uint8_t more = 1; more;) {
+        more = 0;
+        for (uint8_t a = 0; a < 8; a++) {
+            if (!sprites[a].redraw) {
+                continue;
+            }
+            for (uint8_t b = 0; b < 8; b++) {
+                sprite_t *other = &sprites[b];
+                if ((regs[0x15] & (1 << b)) && !other->redraw
+                    && (other->x < sprites[a].x + sprites[a].width) && (sprites[a].x < other->x + other->width)
+                    && (other->y < sprites[a].y + sprites[a].height) && (sprites[a].y < other->y + other->height)) {
+                    other->redraw = 1;
+                    more = 1;
+                }
+            }
+        }
+    }
+}
+
+// the drawn screen moved up by dy pixels, taking any sprite images with it
+void sprite_scrolled(int16_t dy) {
+    for (uint8_t n = 0; n < 8; n++) {
+        sprite_t *sprite = &sprites[n];
+        if (sprite->drawn) {
+            vic_mark_rect(sprite->x, sprite->y - dy, sprite->width, sprite->height);
+            vic_mark_rect(sprite->x, sprite->y, sprite->width, sprite->height);
+        }
+    }
+}
+
+// 48 bits of background foreground pixels starting at display pixel x
+static uint64_t background_mask(mem_t *mem, int16_t x, uint8_t y) {
+    // sprites start no further left than x = -24, so this rounds towards minus infinity
+    int16_t first = (x + 32) / 8 - 4;
+    uint64_t bits = 0;
+    for (int16_t col = first; col < first + 7; col++) {
+        bits <<= 8;
+        if ((col >= 0) && (col < 40)) {
+            bits |= vic_foreground(mem, col, y);
+        }
+    }
+    return (bits >> (8 - (x - first * 8))) & 0xFFFFFFFFFFFFULL;
+}
+
+// composite enabled sprites scanline by scanline and latch collisions into $D01E/$D01F. Returns
+// the text rows (one bit each) the redrawn sprites cover, for vic_refresh to blit
+uint32_t sprite_draw(mem_t *mem) {
+    uint8_t *regs = mem->vic;
+    uint8_t enabled = regs[0x15];
+    uint32_t covered = 0;
+    if (!enabled) {
+        return 0;
+    }
+    int16_t top = 200;
+    int16_t bottom = 0;
+    for (uint8_t n = 0; n < 8; n++) {
+        if (enabled & (1 << n)) {
+            if (sprites[n].y < top) {
+                top = sprites[n].y;
+            }
+            if (sprites[n].y + sprites[n].height > bottom) {
+                bottom = sprites[n].y + sprites[n].height;
+            }
+        }
+    }
+    if (top < 0) {
+        top = 0;
+    }
+    if (bottom > 200) {
+        bottom = 200;
+    }
+    uint8_t sprite_hits = 0;
+    uint8_t background_hits = 0;
+    for (int16_t y = top; y < bottom; y++) {
+        uint8_t active = 0;
+        uint64_t masks[8];
+        uint64_t background[8];
+        uint8_t rows[8];
+        for (uint8_t n = 0; n < 8; n++) {
+            sprite_t *sprite = &sprites[n];
+            if (!(enabled & (1 << n)) || (y < sprite->y) || (y >= sprite->y + sprite->height)) {
+                continue;
+            }
+            rows[n] = (y - sprite->y) >> (sprite->height > 21);
+            masks[n] = sprite->mask[rows[n]];
+            if (!masks[n]) {
+                continue;
+            }
+            active |= 1 << n;
+            background[n] = background_mask(mem, sprite->x, y);
+            if (masks[n] & background[n]) {
+                background_hits |= 1 << n;
+            }
+        }
+        if (!active) {
+            continue;
+        }
+        // sprite-sprite collisions, by ANDing each pair of row masks shifted to the same origin
+        for (uint8_t a = 0; a < 8; a++) {
+            if (!(active & (1 << a))) {
+                continue;
+            }
+            for (uint8_t b = a + 1; b < 8; b++) {
+                if (!(active & (1 << b))) {
+                    continue;
+                }
+                int16_t distance = sprites[b].x - sprites[a].x;
+                uint64_t overlap = 0;
+                if ((distance >= 0) && (distance < 48)) {
+                    overlap = masks[a] & (masks[b] >> distance);
+                } else if ((distance < 0) && (distance > -48)) {
+                    overlap = masks[b] & (masks[a] >> -distance);
+                }
+                if (overlap) {
+                    sprite_hits |= (1 << a) | (1 << b);
+                }
+            }
+        }
+        // lower numbered sprites are in front, so draw from 7 down to 0
+        uint8_t *line = (*gfx_vbuffer)[y + Y_OFFSET];
+        for (uint8_t n = 8; n--;) {
+            sprite_t *sprite = &sprites[n];
+            if (!(active & (1 << n)) || !sprite->redraw) {
+                continue;
+            }
+            uint64_t mask = masks[n];
+            if (sprite->behind) {
+                mask &= ~background[n];
+            }
+            const uint8_t *color = sprite->color[rows[n]];
+            for (uint8_t i = 0; i < sprite->width; i++) {
+                int16_t x = sprite->x + i;
+                if ((mask & (1ULL << (47 - i))) && (x >= 0) && (x < 320)) {
+                    line[x] = color[i];
+                }
+            }
+        }
+    }
+    regs[0x1E] |= sprite_hits;
+    regs[0x1F] |= background_hits;
+    for (uint8_t n = 0; n < 8; n++) {
+        sprite_t *sprite = &sprites[n];
+        if ((enabled & (1 << n)) && sprite->redraw) {
+            int16_t y0 = sprite->y < 0 ? 0 : sprite->y;
+            int16_t y1 = sprite->y + sprite->height > 200 ? 200 : sprite->y + sprite->height;
+            for (int16_t y = y0; y < y1; y += 8) {
+                covered |= 1UL << (y >> 3);
+            }
+            if (y1 > y0) {
+                covered |= 1UL << ((y1 - 1) >> 3);
+            }
+            sprite->drawn = 1;
+        }
+    }
+    return covered;
+}
@@ -0,0 +1,11 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+#include <stdint.h>
+#include "memory.h"
+void sprite_poke(mem_t *mem, uint16_t address);
+void sprite_span(mem_t *mem, uint16_t address, uint16_t end);
+void sprite_register(mem_t *mem, uint8_t reg, uint8_t old);
+void sprite_prepare(mem_t *mem);
+void sprite_scrolled(int16_t dy);
+uint32_t sprite_draw(mem_t *mem);
+#endif
@@ -0,0 +1,113 @@
+// Checks ADC and SBC from src/alu.h against a plain model of the NMOS 6510 for every accumulator,
+// operand, carry and decimal flag, comparing A, N, V, Z and C. This runs on the host, not the
+// calculator:
+//
+//   cc -O2 -o alucheck tools/alucheck.c
+//   ./alucheck
+//
+// It prints the first few differences and exits with 1 if there were any. The decimal mode model
+// follows appendix A of Bruce Clark's "Decimal Mode" tutorial on 6502.org.
+#include <stdint.h>
+#include <stdio.h>
+#include "../src/alu.h"
+
+enum {
+    FLAG_C = 0x01,
+    FLAG_Z = 0x02,
+    FLAG_D = 0x08,
+    FLAG_V = 0x40,
+    FLAG_N = 0x80,
+};
+
+typedef struct result {
+    uint8_t a;
+    uint8_t p;
+} result_t;
+
+static uint8_t set(uint8_t p, uint8_t flag, int on) {
+    return on ? (p | flag) : (p & ~flag);
+}
+
+static result_t model_adc(uint8_t a, uint8_t m, uint8_t p) {
+    int carry = p & FLAG_C;
+    int binary = a + m + carry;
+    result_t r;
+    if (!(p & FLAG_D)) {
+        r.a = binary;
+        p = set(p, FLAG_C, binary > 0xFF);
+        p = set(p, FLAG_V, (~(a ^ m) & (a ^ binary) & 0x80) != 0);
+        p = set(p, FLAG_N, binary & 0x80);
+        p = set(p, FLAG_Z, (binary & 0xFF) == 0);
+        r.p = p;
+        return r;
+    }
+    int lo = (a & 0x0F) + (m & 0x0F) + carry;
+    if (lo >= 0x0A) {
+        lo = ((lo + 0x06) & 0x0F) + 0x10;
+    }
+    int sum = (a & 0xF0) + (m & 0xF0) + lo;
+    // N and V see the sum before the high digit is adjusted, taken as signed
+    int signed_sum = (int8_t) (a & 0xF0) + (int8_t) (m & 0xF0) + lo;
+    if (sum >= 0xA0) {
+        sum += 0x60;
+    }
+    r.a = sum;
+    p = set(p, FLAG_C, sum >= 0x100);
+    p = set(p, FLAG_V, (signed_sum < -128) || (signed_sum > 127));
+    p = set(p, FLAG_N, signed_sum & 0x80);
+    p = set(p, FLAG_Z, (binary & 0xFF) == 0);
+    r.p = p;
+    return r;
+}
+
+static result_t model_sbc(uint8_t a, uint8_t m, uint8_t p) {
+    int borrow = !(p & FLAG_C);
+    int binary = a - m - borrow;
+    result_t r;
+    // the flags are the binary ones in both modes
+    p = set(p, FLAG_C, binary >= 0);
+    p = set(p, FLAG_V, ((a ^ m) & (a ^ binary) & 0x80) != 0);
+    p = set(p, FLAG_N, binary & 0x80);
+    p = set(p, FLAG_Z, (binary & 0xFF) == 0);
+    r.p = p;
+    r.a = binary;
+    if (p & FLAG_D) {
+        int lo = (a & 0x0F) - (m & 0x0F) - borrow;
+        if (lo < 0) {
+            lo = ((lo - 0x06) & 0x0F) - 0x10;
+        }
+        int difference = (a & 0xF0) - (m & 0xF0) + lo;
+        if (difference < 0) {
+            difference -= 0x60;
+        }
+        r.a = difference;
+    }
+    return r;
+}
+
+int main(void) {
+    unsigned long checked = 0;
+    unsigned long wrong = 0;
+    for (int op = 0; op < 2; op++) {
+        for (int flags = 0; flags < 4; flags++) {
+            // I and the unused bit are set too, to see that nothing else in P changes
+            uint8_t p = 0x24 | ((flags & 1) ? FLAG_C : 0) | ((flags & 2) ? FLAG_D : 0);
+            for (int a = 0; a < 256; a++) {
+                for (int m = 0; m < 256; m++) {
+                    result_t want = op ? model_sbc(a, m, p) : model_adc(a, m, p);
+                    uint8_t got_p = p;
+                    uint8_t got_a = op ? alu_sbc(a, m, &got_p) : alu_adc(a, m, &got_p);
+                    checked++;
+                    if ((got_a != want.a) || (got_p != want.p)) {
+                        if (++wrong <= 16) {
+                            printf("%s A=%02X M=%02X C=%d D=%d: got A=%02X P=%02X, want A=%02X P=%02X\n",
+                                   op ? "SBC" : "ADC", a, m, flags & 1, flags >> 1, got_a, got_p, want.a, want.p);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("checked=%lu differences=%lu result=%s\n", checked, wrong, wrong ? "fail" : "pass");
+    return wrong != 0;
+}
@@ -0,0 +1,138 @@
+// Turns a typing script into a keypad recording for the replay mode, so benchmark workloads can be
+// kept as text. This runs on the host, not the calculator:
+//
+//   cc -O2 -o mkrec tools/mkrec.c
+//   ./mkrec bench/scroll.txt > scroll.bin
+//   convbin -i scroll.bin -o C64REC.8xv -n C64REC -k 8xv
+//
+// Every line of the script is typed followed by [enter]. Lines starting with # are comments, and
+// "@wait n" waits n keypad scans (one per IRQ, 60 per emulated second). The output has the layout of
+// record_header_t and record_event_t in src/record.h, with the cycle stamps left at 0.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// scan codes from ti/getcsc.h
+enum {
+    SK_DOWN = 1, SK_LEFT, SK_RIGHT, SK_UP, SK_ENTER = 9, SK_ADD, SK_SUB, SK_MUL, SK_DIV, SK_POWER,
+    SK_CHS = 17, SK_3, SK_6, SK_9, SK_RPAREN, SK_TAN, SK_VARS, SK_DECPNT = 25, SK_2, SK_5, SK_8,
+    SK_LPAREN, SK_COS, SK_PRGM, SK_0 = 33, SK_1, SK_4, SK_7, SK_COMMA, SK_SIN, SK_APPS,
+    SK_GRAPHVAR, SK_LN = 43, SK_LOG, SK_SQUARE, SK_RECIP, SK_MATH, SK_ALPHA, SK_2ND = 54, SK_DEL = 56,
+};
+
+enum { PLAIN, ALPHA, SECOND, BOTH };
+
+typedef struct typed_key {
+    char c;
+    uint8_t sk;
+    uint8_t mod;
+} typed_key_t;
+
+// the inverse of ti_key_to_64_key in src/input.c, which has no K
+static const typed_key_t keys[] = {
+    {'A', SK_MATH, PLAIN}, {'B', SK_APPS, PLAIN}, {'C', SK_PRGM, PLAIN}, {'D', SK_RECIP, PLAIN},
+    {'E', SK_SIN, PLAIN}, {'F', SK_COS, PLAIN}, {'G', SK_TAN, PLAIN}, {'H', SK_POWER, PLAIN},
+    {'I', SK_SQUARE, PLAIN}, {'J', SK_COMMA, PLAIN}, {'L', SK_RPAREN, PLAIN}, {'M', SK_DIV, PLAIN},
+    {'N', SK_LOG, PLAIN}, {'O', SK_7, PLAIN}, {'P', SK_8, PLAIN}, {'Q', SK_9, PLAIN},
+    {'R', SK_MUL, PLAIN}, {'S', SK_LN, PLAIN}, {'T', SK_4, PLAIN}, {'U', SK_5, PLAIN},
+    {'V', SK_6, PLAIN}, {'W', SK_SUB, PLAIN}, {'X', SK_VARS, PLAIN}, {'Y', SK_1, PLAIN},
+    {'Z', SK_2, PLAIN}, {' ', SK_DEL, PLAIN}, {'"', SK_ADD, PLAIN}, {'@', SK_3, PLAIN},
+    {':', SK_DECPNT, PLAIN}, {'(', SK_LPAREN, PLAIN}, {'0', SK_0, ALPHA}, {'1', SK_1, ALPHA},
+    {'2', SK_2, ALPHA}, {'3', SK_3, ALPHA}, {'4', SK_4, ALPHA}, {'5', SK_5, ALPHA}, {'6', SK_6, ALPHA},
+    {'7', SK_7, ALPHA}, {'8', SK_8, ALPHA}, {'9', SK_9, ALPHA}, {'?', SK_CHS, PLAIN},
+    {'/', SK_DIV, ALPHA}, {'*', SK_MUL, ALPHA}, {'-', SK_SUB, ALPHA}, {'+', SK_ADD, ALPHA},
+    {',', SK_COMMA, ALPHA}, {'.', SK_DECPNT, ALPHA}, {')', SK_RPAREN, ALPHA}, {'<', SK_COMMA, SECOND},
+    {'>', SK_DECPNT, SECOND}, {'!', SK_1, BOTH}, {'#', SK_3, BOTH}, {'$', SK_4, BOTH},
+    {'%', SK_5, BOTH}, {'&', SK_6, BOTH}, {'\'', SK_7, BOTH},
+};
+
+static uint32_t frame;
+static uint32_t count;
+
+static void put32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        putchar((value >> (i * 8)) & 0xFF);
+    }
+}
+
+// kb_Data[1] to kb_Data[7] with the given scan codes held
+static void event(const uint8_t *held, int n) {
+    uint8_t data[8] = {0};
+    for (int i = 0; i < n; i++) {
+        data[7 - (held[i] - 1) / 8] |= 1 << ((held[i] - 1) % 8);
+    }
+    put32(frame);
+    put32(0);
+    fwrite(&data[1], 1, 7, stdout);
+    count++;
+}
+
+// hold the key for two scans and let go for two, so repeated letters register
+static void press(uint8_t sk, uint8_t mod) {
+    uint8_t held[3];
+    int n = 0;
+    held[n++] = sk;
+    if (mod & ALPHA) {
+        held[n++] = SK_ALPHA;
+    }
+    if (mod & SECOND) {
+        held[n++] = SK_2ND;
+    }
+    event(held, n);
+    frame += 2;
+    event(held, 0);
+    frame += 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s script.txt > recording.bin\n", argv[0]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    // the header is written again at the end, once the length is known
+    put32(0);
+    put32(0);
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), in)) {
+        number++;
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#') {
+            continue;
+        }
+        if (line[0] == '@') {
+            unsigned long wait;
+            if (sscanf(line, "@wait %lu", &wait) != 1) {
+                fprintf(stderr, "%s:%d: unknown command\n", argv[1], number);
+                return 1;
+            }
+            frame += wait;
+            continue;
+        }
+        for (char *c = line; *c; c++) {
+            size_t i;
+            for (i = 0; i < sizeof(keys) / sizeof(keys[0]) && keys[i].c != *c; i++);
+            if (i == sizeof(keys) / sizeof(keys[0])) {
+                fprintf(stderr, "%s:%d: no key types '%c'\n", argv[1], number, *c);
+                return 1;
+            }
+            press(keys[i].sk, keys[i].mod);
+        }
+        press(SK_ENTER, PLAIN);
+    }
+    fclose(in);
+    if (fseek(stdout, 0, SEEK_SET)) {
+        fprintf(stderr, "output must be a file\n");
+        return 1;
+    }
+    put32(frame);
+    put32(0);
+    fprintf(stderr, "%lu events, %lu frames\n", (unsigned long) count, (unsigned long) frame);
+    return 0;
+}
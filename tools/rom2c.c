@@ -0,0 +1,432 @@
+// Translates the C64 KERNAL and BASIC ROMs into C, one function per basic block, for the ROM_AOT build.
+// This runs on the host, not the calculator:
+//
+//   cc -O2 -o rom2c tools/rom2c.c
+//   ./rom2c KERN.ROM BASIC.ROM [max blocks] > src/rom_aot.inc
+//
+// Blocks are found by following control flow from the reset/IRQ/NMI vectors, the KERNAL jump table,
+// the default RAM vectors and the BASIC dispatch tables. Each block runs the same cpu_* functions the
+// interpreter uses with the operands folded in, and hands control back to the interpreter at every
+// jump, branch, call or return, so indirect jumps, code in RAM and targets that weren't discovered
+// are simply interpreted. Blocks are numbered breadth first from the IRQ handler outwards, so limiting the
+// number of blocks (to keep the program small enough for the calculator) keeps the hottest ones. The ROM checksums are emitted too, so the emulator can refuse blocks that
+// were generated from different ROMs.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum mode {IMP, IMM, ZP, ZPX, ZPY, ABS, ABSX, ABSY, IND, INDX, INDY, REL};
+enum kind {NONE, OP, STMT, BRANCH_SET, BRANCH_CLEAR, JMP, JMPI, JSR, BRK, END};
+
+typedef struct opcode {
+    const char *name;
+    enum mode mode;
+    enum kind kind;
+    // function taking an address for OP, the whole statement for STMT and END, the flag for branches
+    const char *code;
+    uint8_t cycles;
+} opcode_t;
+
+// the documented opcodes, as handled by the switch in cpu_exec. Undocumented ones are left to the interpreter
+static const opcode_t opcodes[256] = {
+    [0x00] = {"BRK", IMP, BRK, "cpu_brk(cpu);", 7},
+    [0x01] = {"ORA", INDX, OP, "cpu_ora", 6},
+    [0x05] = {"ORA", ZP, OP, "cpu_ora", 3},
+    [0x06] = {"ASL", ZP, OP, "cpu_asl", 5},
+    [0x08] = {"PHP", IMP, STMT, "cpu_php(cpu);", 3},
+    [0x09] = {"ORA", IMM, OP, "cpu_ora", 2},
+    [0x0A] = {"ASL", IMP, STMT, "cpu_asl_A(cpu);", 2},
+    [0x0D] = {"ORA", ABS, OP, "cpu_ora", 4},
+    [0x0E] = {"ASL", ABS, OP, "cpu_asl", 6},
+    [0x10] = {"BPL", REL, BRANCH_CLEAR, "N", 2},
+    [0x11] = {"ORA", INDY, OP, "cpu_ora", 5},
+    [0x15] = {"ORA", ZPX, OP, "cpu_ora", 4},
+    [0x16] = {"ASL", ZPX, OP, "cpu_asl", 6},
+    [0x18] = {"CLC", IMP, STMT, "setflag(cpu, C, 0);", 2},
+    [0x19] = {"ORA", ABSY, OP, "cpu_ora", 4},
+    [0x1D] = {"ORA", ABSX, OP, "cpu_ora", 4},
+    [0x1E] = {"ASL", ABSX, OP, "cpu_asl", 7},
+    [0x20] = {"JSR", ABS, JSR, "cpu_jsr", 6},
+    [0x29] = {"AND", IMM, OP, "cpu_and_", 2},
+    [0x21] = {"AND", INDX, OP, "cpu_and_", 6},
+    [0x24] = {"BIT", ZP, OP, "cpu_bit", 3},
+    [0x25] = {"AND", ZP, OP, "cpu_and_", 3},
+    [0x26] = {"ROL", ZP, OP, "cpu_rol", 5},
+    [0x28] = {"PLP", IMP, STMT, "cpu_plp(cpu);", 4},
+    [0x2A] = {"ROL", IMP, STMT, "cpu_rol_A(cpu);", 2},
+    [0x2C] = {"BIT", ABS, OP, "cpu_bit", 4},
+    [0x2D] = {"AND", ABS, OP, "cpu_and_", 4},
+    [0x2E] = {"ROL", ABS, OP, "cpu_rol", 6},
+    [0x30] = {"BMI", REL, BRANCH_SET, "N", 2},
+    [0x31] = {"AND", INDY, OP, "cpu_and_", 5},
+    [0x35] = {"AND", ZPX, OP, "cpu_and_", 4},
+    [0x36] = {"ROL", ZPX, OP, "cpu_rol", 6},
+    [0x38] = {"SEC", IMP, STMT, "setflag(cpu, C, 1);", 2},
+    [0x39] = {"AND", ABSY, OP, "cpu_and_", 4},
+    [0x3D] = {"AND", ABSX, OP, "cpu_and_", 4},
+    [0x3E] = {"ROL", ABSX, OP, "cpu_rol", 7},
+    [0x40] = {"RTI", IMP, END, "cpu_rti(cpu);", 6},
+    [0x41] = {"EOR", INDX, OP, "cpu_eor", 6},
+    [0x45] = {"EOR", ZP, OP, "cpu_eor", 3},
+    [0x46] = {"LSR", ZP, OP, "cpu_lsr", 5},
+    [0x48] = {"PHA", IMP, STMT, "cpu_push(cpu, cpu->a);", 3},
+    [0x49] = {"EOR", IMM, OP, "cpu_eor", 2},
+    [0x4A] = {"LSR", IMP, STMT, "cpu_lsr_A(cpu);", 2},
+    [0x4C] = {"JMP", ABS, JMP, "", 3},
+    [0x4D] = {"EOR", ABS, OP, "cpu_eor", 4},
+    [0x4E] = {"LSR", ABS, OP, "cpu_lsr", 6},
+    [0x50] = {"BVC", REL, BRANCH_CLEAR, "V", 2},
+    [0x51] = {"EOR", INDY, OP, "cpu_eor", 5},
+    [0x55] = {"EOR", ZPX, OP, "cpu_eor", 4},
+    [0x56] = {"LSR", ZPX, OP, "cpu_lsr", 6},
+    [0x58] = {"CLI", IMP, STMT, "setflag(cpu, I, 0);", 2},
+    [0x59] = {"EOR", ABSY, OP, "cpu_eor", 4},
+    [0x5D] = {"EOR", ABSX, OP, "cpu_eor", 4},
+    [0x5E] = {"LSR", ABSX, OP, "cpu_lsr", 7},
+    [0x60] = {"RTS", IMP, END, "cpu_rts(cpu);", 6},
+    [0x61] = {"ADC", INDX, OP, "cpu_adc", 6},
+    [0x65] = {"ADC", ZP, OP, "cpu_adc", 3},
+    [0x66] = {"ROR", ZP, OP, "cpu_ror", 5},
+    [0x68] = {"PLA", IMP, STMT, "cpu_pla(cpu);", 4},
+    [0x69] = {"ADC", IMM, OP, "cpu_adc", 2},
+    [0x6A] = {"ROR", IMP, STMT, "cpu_ror_A(cpu);", 2},
+    [0x6C] = {"JMP", IND, JMPI, "", 5},
+    [0x6D] = {"ADC", ABS, OP, "cpu_adc", 4},
+    [0x6E] = {"ROR", ABS, OP, "cpu_ror", 6},
+    [0x70] = {"BVS", REL, BRANCH_SET, "V", 2},
+    [0x71] = {"ADC", INDY, OP, "cpu_adc", 5},
+    [0x75] = {"ADC", ZPX, OP, "cpu_adc", 4},
+    [0x76] = {"ROR", ZPX, OP, "cpu_ror", 6},
+    [0x78] = {"SEI", IMP, STMT, "setflag(cpu, I, 1);", 2},
+    [0x79] = {"ADC", ABSY, OP, "cpu_adc", 4},
+    [0x7D] = {"ADC", ABSX, OP, "cpu_adc", 4},
+    [0x7E] = {"ROR", ABSX, OP, "cpu_ror", 7},
+    [0x81] = {"STA", INDX, OP, "cpu_sta", 6},
+    [0x84] = {"STY", ZP, OP, "cpu_sty", 3},
+    [0x85] = {"STA", ZP, OP, "cpu_sta", 3},
+    [0x86] = {"STX", ZP, OP, "cpu_stx", 3},
+    [0x88] = {"DEY", IMP, STMT, "cpu_dey(cpu);", 2},
+    [0x8A] = {"TXA", IMP, STMT, "cpu_txa(cpu);", 2},
+    [0x8C] = {"STY", ABS, OP, "cpu_sty", 4},
+    [0x8D] = {"STA", ABS, OP, "cpu_sta", 4},
+    [0x8E] = {"STX", ABS, OP, "cpu_stx", 4},
+    [0x90] = {"BCC", REL, BRANCH_CLEAR, "C", 2},
+    [0x91] = {"STA", INDY, OP, "cpu_sta", 6},
+    [0x94] = {"STY", ZPX, OP, "cpu_sty", 4},
+    [0x95] = {"STA", ZPX, OP, "cpu_sta", 4},
+    [0x96] = {"STX", ZPY, OP, "cpu_stx", 4},
+    [0x98] = {"TYA", IMP, STMT, "cpu_tya(cpu);", 2},
+    [0x99] = {"STA", ABSY, OP, "cpu_sta", 5},
+    [0x9A] = {"TXS", IMP, STMT, "cpu_txs(cpu);", 2},
+    [0x9D] = {"STA", ABSX, OP, "cpu_sta", 5},
+    [0xA0] = {"LDY", IMM, OP, "cpu_ldy", 2},
+    [0xA1] = {"LDA", INDX, OP, "cpu_lda", 6},
+    [0xA2] = {"LDX", IMM, OP, "cpu_ldx", 2},
+    [0xA4] = {"LDY", ZP, OP, "cpu_ldy", 3},
+    [0xA5] = {"LDA", ZP, OP, "cpu_lda", 3},
+    [0xA6] = {"LDX", ZP, OP, "cpu_ldx", 3},
+    [0xA8] = {"TAY", IMP, STMT, "cpu_tay(cpu);", 2},
+    [0xA9] = {"LDA", IMM, OP, "cpu_lda", 2},
+    [0xAA] = {"TAX", IMP, STMT, "cpu_tax(cpu);", 2},
+    [0xAC] = {"LDY", ABS, OP, "cpu_ldy", 4},
+    [0xAD] = {"LDA", ABS, OP, "cpu_lda", 4},
+    [0xAE] = {"LDX", ABS, OP, "cpu_ldx", 4},
+    [0xB0] = {"BCS", REL, BRANCH_SET, "C", 2},
+    [0xB1] = {"LDA", INDY, OP, "cpu_lda", 5},
+    [0xB4] = {"LDY", ZPX, OP, "cpu_ldy", 4},
+    [0xB5] = {"LDA", ZPX, OP, "cpu_lda", 4},
+    [0xB6] = {"LDX", ZPY, OP, "cpu_ldx", 4},
+    [0xB8] = {"CLV", IMP, STMT, "setflag(cpu, V, 0);", 2},
+    [0xB9] = {"LDA", ABSY, OP, "cpu_lda", 4},
+    [0xBA] = {"TSX", IMP, STMT, "cpu_tsx(cpu);", 2},
+    [0xBC] = {"LDY", ABSX, OP, "cpu_ldy", 4},
+    [0xBD] = {"LDA", ABSX, OP, "cpu_lda", 4},
+    [0xBE] = {"LDX", ABSY, OP, "cpu_ldx", 4},
+    [0xC0] = {"CPY", IMM, OP, "cpu_cpy", 2},
+    [0xC1] = {"CMP", INDX, OP, "cpu_cmp", 6},
+    [0xC4] = {"CPY", ZP, OP, "cpu_cpy", 3},
+    [0xC5] = {"CMP", ZP, OP, "cpu_cmp", 3},
+    [0xC6] = {"DEC", ZP, OP, "cpu_dec_", 5},
+    [0xC8] = {"INY", IMP, STMT, "cpu_iny(cpu);", 2},
+    [0xC9] = {"CMP", IMM, OP, "cpu_cmp", 2},
+    [0xCA] = {"DEX", IMP, STMT, "cpu_dex(cpu);", 2},
+    [0xCC] = {"CPY", ABS, OP, "cpu_cpy", 4},
+    [0xCD] = {"CMP", ABS, OP, "cpu_cmp", 4},
+    [0xCE] = {"DEC", ABS, OP, "cpu_dec_", 6},
+    [0xD0] = {"BNE", REL, BRANCH_CLEAR, "Z", 2},
+    [0xD1] = {"CMP", INDY, OP, "cpu_cmp", 5},
+    [0xD5] = {"CMP", ZPX, OP, "cpu_cmp", 4},
+    [0xD6] = {"DEC", ZPX, OP, "cpu_dec_", 6},
+    [0xD8] = {"CLD", IMP, STMT, "setflag(cpu, D, 0);", 2},
+    [0xD9] = {"CMP", ABSY, OP, "cpu_cmp", 4},
+    [0xDD] = {"CMP", ABSX, OP, "cpu_cmp", 4},
+    [0xDE] = {"DEC", ABSX, OP, "cpu_dec_", 7},
+    [0xE0] = {"CPX", IMM, OP, "cpu_cpx", 2},
+    [0xE1] = {"SBC", INDX, OP, "cpu_sbc", 6},
+    [0xE4] = {"CPX", ZP, OP, "cpu_cpx", 3},
+    [0xE5] = {"SBC", ZP, OP, "cpu_sbc", 3},
+    [0xE6] = {"INC", ZP, OP, "cpu_inc_", 5},
+    [0xE8] = {"INX", IMP, STMT, "cpu_inx(cpu);", 2},
+    [0xE9] = {"SBC", IMM, OP, "cpu_sbc", 2},
+    [0xEC] = {"CPX", ABS, OP, "cpu_cpx", 4},
+    [0xEA] = {"NOP", IMP, STMT, "", 2},
+    [0xED] = {"SBC", ABS, OP, "cpu_sbc", 4},
+    [0xEE] = {"INC", ABS, OP, "cpu_inc_", 6},
+    [0xF0] = {"BEQ", REL, BRANCH_SET, "Z", 2},
+    [0xF1] = {"SBC", INDY, OP, "cpu_sbc", 5},
+    [0xF5] = {"SBC", ZPX, OP, "cpu_sbc", 4},
+    [0xF6] = {"INC", ZPX, OP, "cpu_inc_", 6},
+    [0xF8] = {"SED", IMP, STMT, "setflag(cpu, D, 1);", 2},
+    [0xF9] = {"SBC", ABSY, OP, "cpu_sbc", 4},
+    [0xFD] = {"SBC", ABSX, OP, "cpu_sbc", 4},
+    [0xFE] = {"INC", ABSX, OP, "cpu_inc_", 7},
+};
+
+static const uint8_t lengths[] = {
+    [IMP] = 1, [IMM] = 2, [ZP] = 2, [ZPX] = 2, [ZPY] = 2, [ABS] = 3, [ABSX] = 3, [ABSY] = 3,
+    [IND] = 3, [INDX] = 2, [INDY] = 2, [REL] = 2,
+};
+
+static uint8_t rom[0x10000];
+static uint8_t visited[0x10000];
+// discovery order of each block start, 0 for addresses that don't start a block
+static uint32_t leader[0x10000];
+static uint16_t work[0x10000];
+static uint32_t head;
+static uint32_t tail;
+static uint32_t max_blocks = 0xFFFFFFFF;
+
+// mem_peek reads RAM at $BFFF, so only $A000-$BFFE and $E000-$FFFF are translated
+static int in_rom(uint32_t address) {
+    return ((address >= 0xA000) && (address <= 0xBFFE)) || ((address >= 0xE000) && (address <= 0xFFFF));
+}
+
+static uint16_t word(uint16_t address) {
+    return rom[address] | (rom[(uint16_t) (address + 1)] << 8);
+}
+
+static void add_leader(uint32_t address) {
+    if (in_rom(address) && !leader[address]) {
+        leader[address] = ++tail;
+        work[tail - 1] = address;
+    }
+}
+
+static int translated(uint32_t address);
+
+// address can be $10000, just past an instruction that ends at $FFFF, so it's checked before indexing
+static int decodable(uint32_t address) {
+    if (!in_rom(address)) {
+        return 0;
+    }
+    const opcode_t *op = &opcodes[rom[address]];
+    return (op->kind != NONE) && in_rom(address + lengths[op->mode] - 1);
+}
+
+// follow control flow from every leader, adding branch targets and return addresses as new leaders
+static void discover(void) {
+    while (head < tail) {
+        uint32_t pc = work[head++];
+        while (decodable(pc) && !visited[pc]) {
+            const opcode_t *op = &opcodes[rom[pc]];
+            uint32_t next = pc + lengths[op->mode];
+            visited[pc] = 1;
+            if ((op->kind == BRANCH_SET) || (op->kind == BRANCH_CLEAR)) {
+                add_leader((uint16_t) (next + (int8_t) rom[pc + 1]));
+                add_leader(next);
+                break;
+            }
+            if (op->kind == JMP) {
+                add_leader(word(pc + 1));
+                break;
+            }
+            if (op->kind == JSR) {
+                add_leader(word(pc + 1));
+                add_leader(next);
+                break;
+            }
+            if ((op->kind == JMPI) || (op->kind == BRK) || (op->kind == END)) {
+                break;
+            }
+            pc = next;
+        }
+    }
+}
+
+static int translated(uint32_t address) {
+    return in_rom(address) && leader[address] && (leader[address] <= max_blocks) && decodable(address);
+}
+
+static void add_vector_table(uint16_t start, uint8_t count, uint8_t stride, uint8_t offset, int8_t adjust) {
+    for (uint8_t i = 0; i < count; i++) {
+        add_leader((uint16_t) (word(start + i * stride + offset) + adjust));
+    }
+}
+
+static uint32_t rom_sum(const uint8_t *data, uint16_t size) {
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < size; i++) {
+        sum = ((sum << 5) | (sum >> 27)) + data[i];
+    }
+    return sum;
+}
+
+static void operand(char *out, const opcode_t *op, uint16_t pc) {
+    uint8_t zp = rom[(uint16_t) (pc + 1)];
+    uint16_t abs = word(pc + 1);
+    switch (op->mode) {
+        case IMM: sprintf(out, "0x%04X", pc + 1); break;
+        case ZP: sprintf(out, "0x%02X", zp); break;
+        case ZPX: sprintf(out, "AOT_ZPX(0x%02X)", zp); break;
+        case ZPY: sprintf(out, "AOT_ZPY(0x%02X)", zp); break;
+        case ABS: sprintf(out, "0x%04X", abs); break;
+        case ABSX: sprintf(out, "AOT_ABSX(0x%04X)", abs); break;
+        case ABSY: sprintf(out, "AOT_ABSY(0x%04X)", abs); break;
+        case IND: sprintf(out, "AOT_IND(0x%04X)", abs); break;
+        case INDX: sprintf(out, "AOT_INDX(0x%02X)", zp); break;
+        case INDY: sprintf(out, "AOT_INDY(0x%02X)", zp); break;
+        default: out[0] = 0; break;
+    }
+}
+
+static void emit_block(uint32_t start) {
+    uint32_t pc = start;
+    unsigned count = 0;
+    unsigned cycles = 0;
+    char address[32];
+    printf("static void aot_%04X(cpu_t *cpu) {\n", start);
+    for (;;) {
+        if ((pc != start) && (!decodable(pc) || leader[pc])) {
+            // fall into the next block, or into code the interpreter has to handle, wrapping past $FFFF
+            printf("    AOT_EXIT(0x%04X, %u, %u);\n", pc & 0xFFFF, count, cycles);
+            break;
+        }
+        const opcode_t *op = &opcodes[rom[pc]];
+        uint32_t next = pc + lengths[op->mode];
+        count++;
+        cycles += op->cycles;
+        operand(address, op, pc);
+        printf("    // %04X %s\n", pc, op->name);
+        if (op->kind == OP) {
+            printf("    %s(cpu, %s);\n", op->code, address);
+        } else if (op->kind == STMT) {
+            if (op->code[0]) {
+                printf("    %s\n", op->code);
+            }
+        } else if ((op->kind == BRANCH_SET) || (op->kind == BRANCH_CLEAR)) {
+            uint16_t target = next + (int8_t) rom[pc + 1];
+            printf("    if (%sflagset(cpu, %s)) AOT_EXIT(0x%04X, %u, %u);\n",
+                   op->kind == BRANCH_CLEAR ? "!" : "", op->code, target, count, cycles + 1);
+            printf("    AOT_EXIT(0x%04X, %u, %u);\n", next & 0xFFFF, count, cycles);
+            break;
+        } else if (op->kind == JMP) {
+            printf("    AOT_EXIT(0x%04X, %u, %u);\n", word(pc + 1), count, cycles);
+            break;
+        } else if (op->kind == JMPI) {
+            printf("    cpu->pc = %s;\n", address);
+            printf("    AOT_RETURN(%u, %u);\n", count, cycles);
+            break;
+        } else if (op->kind == JSR) {
+            printf("    cpu->pc = 0x%04X;\n", next & 0xFFFF);
+            printf("    cpu_jsr(cpu, %s);\n", address);
+            printf("    AOT_RETURN(%u, %u);\n", count, cycles);
+            break;
+        } else if (op->kind == BRK) {
+            printf("    cpu->pc = 0x%04X;\n", (pc + 1) & 0xFFFF);
+            printf("    %s\n", op->code);
+            printf("    AOT_RETURN(%u, %u);\n", count, cycles);
+            break;
+        } else {
+            printf("    %s\n", op->code);
+            printf("    AOT_RETURN(%u, %u);\n", count, cycles);
+            break;
+        }
+        pc = next;
+    }
+    printf("}\n\n");
+}
+
+static int load(const char *path, uint16_t base) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return 0;
+    }
+    size_t size = fread(&rom[base], 1, 0x2000, file);
+    fclose(file);
+    if (size != 0x2000) {
+        fprintf(stderr, "%s: expected 8192 bytes, got %zu\n", path, size);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if ((argc != 3) && (argc != 4)) {
+        fprintf(stderr, "usage: %s KERNAL.ROM BASIC.ROM [max blocks] > src/rom_aot.inc\n", argv[0]);
+        return 1;
+    }
+    if (argc == 4) {
+        max_blocks = strtoul(argv[3], NULL, 0);
+    }
+    if (!load(argv[1], 0xE000) || !load(argv[2], 0xA000)) {
+        return 1;
+    }
+    // the IRQ handler first since it runs every frame ($FD30 holds the default for the $0314 IRQ vector),
+    // then the other hardware vectors and the KERNAL jump table
+    add_vector_table(0xFFFE, 1, 2, 0, 0);
+    add_vector_table(0xFD30, 1, 2, 0, 0);
+    add_vector_table(0xFFFA, 3, 2, 0, 0);
+    for (uint16_t entry = 0xFF81; entry <= 0xFFF3; entry += 3) {
+        if (rom[entry] == 0x4C) {
+            add_leader(word(entry + 1));
+        }
+        add_leader(entry);
+    }
+    // defaults the KERNAL copies to the RAM vectors at $0314 and BASIC to $0300
+    add_vector_table(0xFD30, 16, 2, 0, 0);
+    add_vector_table(0xE447, 6, 2, 0, 0);
+    // BASIC cold/warm start, statement dispatch (address - 1 for RTS), functions and operators
+    add_vector_table(0xA000, 2, 2, 0, 0);
+    add_vector_table(0xA00C, 35, 2, 0, 1);
+    add_vector_table(0xA052, 23, 2, 0, 0);
+    add_vector_table(0xA080, 10, 3, 1, 1);
+    discover();
+
+    unsigned blocks = 0;
+    printf("// generated by tools/rom2c, do not edit\n\n");
+    printf("#define AOT_KERNAL_SUM 0x%08lXUL\n", (unsigned long) rom_sum(&rom[0xE000], 0x2000));
+    printf("#define AOT_BASIC_SUM 0x%08lXUL\n\n", (unsigned long) rom_sum(&rom[0xA000], 0x2000));
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        if (translated(pc)) {
+            emit_block(pc);
+            blocks++;
+        }
+    }
+    // sorted by pc, with the first entry of each ROM page ($A0-$BF then $E0-$FF) in aot_pages
+    unsigned pages[0x41];
+    unsigned index = 0;
+    printf("static const aot_entry_t aot_entries[%u] = {\n", blocks);
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        if ((pc & 0xFF) == 0) {
+            if ((pc >= 0xA000) && (pc < 0xC000)) {
+                pages[(pc >> 8) - 0xA0] = index;
+            } else if (pc >= 0xE000) {
+                pages[(pc >> 8) - 0xC0] = index;
+            }
+        }
+        if (translated(pc)) {
+            printf("    {0x%04X, aot_%04X},\n", pc, pc);
+            index++;
+        }
+    }
+    pages[0x40] = index;
+    printf("};\n\nstatic const uint16_t aot_pages[0x41] = {");
+    for (unsigned page = 0; page <= 0x40; page++) {
+        printf("%s%u,", (page % 16) ? " " : "\n    ", pages[page]);
+    }
+    printf("\n};\n");
+    fprintf(stderr, "%u blocks\n", blocks);
+    return 0;
+}